@@ -16,95 +16,303 @@
     along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
 
 #include <malloc.h>
+#include <stdlib.h>
 #include <pthread.h>
 #include <memory.h>
-#include <sys/time.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/futex.h>
+#endif
 #include "block_queue.h"
 #include "log.h"
 
 
 LOG_TAG_DECLR("queue");
 
-queue_t *queue_create(const char *name, uint32_t data_size, uint32_t length, queue_flag_t flag)
+#define QUEUE_SPIN_COUNT    256
+
+// deadlines must not move when the wall clock is stepped or slewed
+#ifdef __linux__
+#define QUEUE_CLOCK         CLOCK_MONOTONIC
+#else
+#define QUEUE_CLOCK         CLOCK_REALTIME
+#endif
+
+// a shared queue has its ring right after the control block, at the same offset in every process
+#define QUEUE_DATA(q)       ((q)->data_offset ? (void *) (q) + (q)->data_offset : (q)->data)
+
+// a drop policy keeps one spare slot to read dropped elements into
+#define QUEUE_SLOTS(q)      ((q)->flag & QUEUE_DROP_POLICY ? (q)->len + 1 : (q)->len)
+#define QUEUE_MAP_SIZE(q)   ((q)->data_offset + (size_t) (q)->size * QUEUE_SLOTS(q))
+
+#define load_acquire(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+// poke the fd a consumer polls on, see queue_set_wakeup()
+#define QUEUE_NOTIFY(q)     do { if (NULL != (q)->wakeup) wakeup_signal((q)->wakeup); } while (0)
+
+static inline void cpu_relax()
 {
-  queue_t *q;
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
 
+/**
+ * check the flags of a new queue, return -1 if it can not be created
+ */
+static int queue_check(const char *name, uint32_t data_size, uint32_t length, uint32_t *flag)
+{
   if (data_size * length == 0) {
     LOGE("param error");
-    return NULL;
+    return -1;
   }
 
-  q = malloc(sizeof(queue_t));
-  if (NULL == q) {
-    LOGE("malloc error: %m");
-    return NULL;
+  if ((*flag & QUEUE_DROP_POLICY) == QUEUE_DROP_POLICY) {
+    LOGE("queue(%s) drop oldest and overwrite are exclusive", name);
+    return -1;
+  }
+
+#ifndef __linux__
+  // the lock-free ring sleeps on futexes
+  *flag &= ~QUEUE_SPSC;
+#endif
+
+  if ((*flag & QUEUE_DROP_POLICY) && (*flag & QUEUE_SPSC)) {
+    // the producer moves the consumer index when it evicts
+    LOGW("queue(%s) drop policy needs the lock, SPSC ignored", name);
+    *flag &= ~QUEUE_SPSC;
   }
 
+  return 0;
+}
+
+static void queue_setup(queue_t *q, const char *name, uint32_t data_size, uint32_t length, uint32_t flag)
+{
   q->f = q->r = 0;
+  q->push_wait = q->pop_wait = 0;
+  q->dropped = q->dropping = q->held = 0;
+  q->closed = 0;
+  q->drop_counter = NULL;
+  q->drop_cb = NULL;
+  q->drop_arg = NULL;
+  q->wakeup = NULL;
   q->len = length;
   q->flag = flag;
   q->size = data_size;
-  q->data = calloc(data_size, length);
+  q->data = NULL;
+  q->data_offset = 0;
 
   q->lock.inited = 0;
 
+  if (name != NULL) strncpy(q->name, name, sizeof(q->name) - 1);
+  else strcpy(q->name, "default queue");
+  q->name[sizeof(q->name) - 1] = 0;
+}
+
+int queue_lock_init(queue_t *q)
+{
+  pthread_condattr_t attr;
+  pthread_mutexattr_t mattr;
+  int pshared = (q->flag & QUEUE_SHARED) ? PTHREAD_PROCESS_SHARED : PTHREAD_PROCESS_PRIVATE;
+
+  if (q->lock.inited) return 0;
+
+  pthread_condattr_init(&attr);
+#ifdef __linux__
+  pthread_condattr_setclock(&attr, QUEUE_CLOCK);
+#endif
+  pthread_condattr_setpshared(&attr, pshared);
+
+  if (pthread_cond_init(&q->lock.push_cond, &attr)) {
+    LOGE("thread push condition create error: %m");
+    pthread_condattr_destroy(&attr);
+    return -1;
+  }
+  if (pthread_cond_init(&q->lock.pop_cond, &attr)) {
+    LOGE("thread pop condition create error: %m");
+    pthread_condattr_destroy(&attr);
+    return -1;
+  }
+  pthread_condattr_destroy(&attr);
+
+  pthread_mutexattr_init(&mattr);
+  pthread_mutexattr_setpshared(&mattr, pshared);
+  if (pthread_mutex_init(&q->lock.mutex, &mattr)) {
+    LOGE("thread lock.mutex create error: %m");
+    pthread_mutexattr_destroy(&mattr);
+    return -1;
+  }
+  pthread_mutexattr_destroy(&mattr);
+
+  q->lock.inited = 1;
+
+  return 0;
+}
+
+queue_t *queue_create(const char *name, uint32_t data_size, uint32_t length, queue_flag_t flag)
+{
+  queue_t *q;
+  uint32_t f = flag & ~QUEUE_SHARED;
+
+  if (queue_check(name, data_size, length, &f) < 0) return NULL;
+
+  if (posix_memalign((void **) &q, QUEUE_CACHE_LINE, sizeof(queue_t))) {
+    LOGE("malloc error: %m");
+    return NULL;
+  }
+
+  queue_setup(q, name, data_size, length, f);
+  q->data = calloc(data_size, QUEUE_SLOTS(q));
+
   if (NULL == q->data) {
     LOGE("calloc error: %m");
     free(q);
     return NULL;
   }
 
-  if (name != NULL) strcpy(q->name, name);
-  else strcpy(q->name, "default queue");
-
   return q;
 }
 
-queue_ret_t queue_destory(queue_t *q) {
-  if (NULL == q) return QUEUE_NOT_EXIST;
+#ifdef __linux__
 
-  if (!q->data || !q->lock.inited) return QUEUE_OK;
+queue_t *queue_create_shared(const char *name, uint32_t data_size, uint32_t length, queue_flag_t flag, int *fd)
+{
+  queue_t *q;
+  size_t map_size;
+  uint32_t f = flag | QUEUE_SHARED;
+  int mfd;
 
-  q->lock.inited = 0;
+  if (NULL == fd || (flag & QUEUE_PTR_DATA)) {
+    LOGE("queue(%s) shared param error", name);
+    return NULL;
+  }
 
-  pthread_mutex_destroy(&q->lock.mutex);
+  if (queue_check(name, data_size, length, &f) < 0) return NULL;
 
-  pthread_cond_destroy(&q->lock.push_cond);
-  pthread_cond_destroy(&q->lock.pop_cond);
+  mfd = memfd_create(name ? name : "queue", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (mfd < 0) {
+    LOGE("queue(%s) memfd_create error: %m", name);
+    return NULL;
+  }
 
-  if (NULL != q->data) {
-    free(q->data);
-    q->data = 0;
+  map_size = sizeof(queue_t) + (size_t) data_size * (f & QUEUE_DROP_POLICY ? length + 1 : length);
+  if (ftruncate(mfd, (off_t) map_size) < 0) {
+    LOGE("queue(%s) ftruncate error: %m", name);
+    close(mfd);
+    return NULL;
   }
-  free(q);
+  // an attached process can not pull the memory from under the creator
+  fcntl(mfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
 
-  return QUEUE_OK;
+  q = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, mfd, 0);
+  if (MAP_FAILED == q) {
+    LOGE("queue(%s) mmap error: %m", name);
+    close(mfd);
+    return NULL;
+  }
+
+  queue_setup(q, name, data_size, length, f);
+  q->data_offset = sizeof(queue_t);
+
+  // every process sees the lock initialized, nobody may race to do it lazily
+  if (queue_lock_init(q) < 0) {
+    munmap(q, map_size);
+    close(mfd);
+    return NULL;
+  }
+
+  *fd = mfd;
+
+  return q;
 }
 
-int queue_lock_init(queue_t *q)
+queue_t *queue_attach_shared(int fd)
 {
-  if (q->lock.inited) return 0;
+  queue_t *q;
+  struct stat st;
 
-  if (pthread_cond_init(&q->lock.push_cond, NULL)) {
-    LOGE("thread push condition create error: %m");
-    return -1;
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(queue_t)) {
+    LOGE("queue attach fd %d error", fd);
+    return NULL;
   }
-  if (pthread_cond_init(&q->lock.pop_cond, NULL)) {
-    LOGE("thread pop condition create error: %m");
-    return -1;
+
+  q = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (MAP_FAILED == q) {
+    LOGE("queue attach mmap error: %m");
+    return NULL;
   }
 
-  if (pthread_mutex_init(&q->lock.mutex, NULL)) {
-    LOGE("thread lock.mutex create error: %m");
-    return -1;
+  if (!(q->flag & QUEUE_SHARED) || !q->lock.inited || q->data_offset != sizeof(queue_t)
+      || st.st_size < QUEUE_MAP_SIZE(q)) {
+    LOGE("queue attach fd %d is not a queue", fd);
+    munmap(q, st.st_size);
+    return NULL;
   }
 
-  q->lock.inited = 1;
+  return q;
+}
 
-  return 0;
+#else
+
+queue_t *queue_create_shared(const char *name, uint32_t data_size, uint32_t length, queue_flag_t flag, int *fd)
+{
+  LOGE("queue(%s) shared memory not supported", name);
+  return NULL;
+}
+
+queue_t *queue_attach_shared(int fd)
+{
+  LOGE("queue shared memory not supported");
+  return NULL;
+}
+
+#endif
+
+queue_ret_t queue_destory(queue_t *q) {
+  if (NULL == q) return QUEUE_NOT_EXIST;
+
+#ifdef __linux__
+  if (q->flag & QUEUE_SHARED) {
+    // the other process may still use the lock, the memory goes with the last mapping
+    munmap(q, QUEUE_MAP_SIZE(q));
+    return QUEUE_OK;
+  }
+#endif
+
+  if (!q->data) return QUEUE_OK;
+
+  if (q->lock.inited) {
+    q->lock.inited = 0;
+
+    pthread_mutex_destroy(&q->lock.mutex);
+
+    pthread_cond_destroy(&q->lock.push_cond);
+    pthread_cond_destroy(&q->lock.pop_cond);
+  }
+
+  if (NULL != q->data) {
+    free(q->data);
+    q->data = 0;
+  }
+  free(q);
+
+  return QUEUE_OK;
 }
 
 queue_ret_t queue_is_full(queue_t *q)
@@ -127,56 +335,443 @@ queue_ret_t queue_is_empty(queue_t *q)
   return QUEUE_OK;
 }
 
-uint32_t queue_len(queue_t *q)
+queue_ret_t queue_is_closed(const queue_t *q)
 {
-  return q->f >= q->r ? (q->f - q->r) : q->len - 1 - (q->r - q->f);
+  if (NULL == q) return QUEUE_NOT_EXIST;
+
+  return load_acquire(&q->closed) ? QUEUE_CLOSED : QUEUE_OK;
 }
 
+queue_ret_t queue_spin_not_empty(const queue_t *q, uint32_t spins)
+{
+  if (NULL == q) return QUEUE_NOT_EXIST;
 
-queue_ret_t queue_push(queue_t *q, void *data, struct timespec *t, push_fn cb)
+  while (load_acquire(&q->f) == load_acquire(&q->r)) {
+    if (0 == spins--) return QUEUE_EMPTY;
+    cpu_relax();
+  }
+
+  return QUEUE_OK;
+}
+
+queue_ret_t queue_set_drop_counter(queue_t *q, uint32_t *counter)
 {
   if (NULL == q) return QUEUE_NOT_EXIST;
+  // the pointer would be followed in the other process
+  if (q->flag & QUEUE_SHARED) return QUEUE_PARAM_ERROR;
 
-  queue_lock_init(q);
-  pthread_mutex_lock(&q->lock.mutex);
+  q->drop_counter = counter;
 
-  if (QUEUE_IS_FULL(q)) {
-    LOGD("queue(%s) is full, block it", q->name);
+  return QUEUE_OK;
+}
 
-    if ((q->flag & QUEUE_BLOCK) == 0) {
-      pthread_mutex_unlock(&q->lock.mutex);
-      return QUEUE_FULL;
+queue_ret_t queue_set_drop_cb(queue_t *q, queue_drop_fn cb, void *arg)
+{
+  if (NULL == q) return QUEUE_NOT_EXIST;
+  if (q->flag & QUEUE_SHARED) return QUEUE_PARAM_ERROR;
+
+  q->drop_arg = arg;
+  q->drop_cb = cb;
+
+  return QUEUE_OK;
+}
+
+queue_ret_t queue_set_wakeup(queue_t *q, wakeup_t *w)
+{
+  if (NULL == q) return QUEUE_NOT_EXIST;
+  if (q->flag & QUEUE_SHARED) return QUEUE_PARAM_ERROR;
+
+  q->wakeup = w;
+
+  return QUEUE_OK;
+}
+
+uint32_t queue_len(queue_t *q)
+{
+  int32_t f = load_acquire(&q->f), r = load_acquire(&q->r);
+
+  return f >= r ? (f - r) : q->len - (r - f);
+}
+
+/**
+ * absolute QUEUE_CLOCK deadline timeout from now, NULL for no timeout
+ */
+static const struct timespec *queue_deadline(struct timespec *deadline, const struct timespec *timeout)
+{
+  if (NULL == timeout) return NULL;
+
+  clock_gettime(QUEUE_CLOCK, deadline);
+  deadline->tv_sec += timeout->tv_sec;
+  deadline->tv_nsec += timeout->tv_nsec;
+  if (deadline->tv_nsec >= 1000000000) {
+    deadline->tv_sec += deadline->tv_nsec / 1000000000;
+    deadline->tv_nsec %= 1000000000;
+  }
+
+  return deadline;
+}
+
+static inline int32_t ring_next(const queue_t *q, int32_t i)
+{
+  return ++i >= q->len ? 0 : i;
+}
+
+#ifdef __linux__
+
+static int spin_count = -1;
+
+// waiters of a shared queue live in other processes
+#define FUTEX_FLAG(q)       ((q)->flag & QUEUE_SHARED ? 0 : FUTEX_PRIVATE_FLAG)
+
+/**
+ * Sleep while *idx still equals seen. The flag is raised before the index is
+ * checked again so the other side either sees it or the futex sees the new
+ * index, no wakeup is lost.
+ */
+static int spsc_wait(int32_t *idx, int32_t seen, uint32_t *waiting, const uint32_t *closed, int futex_flag,
+                     const struct timespec *deadline)
+{
+  int ret = 0;
+
+  if (spin_count < 0) {
+    spin_count = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? QUEUE_SPIN_COUNT : 0;
+  }
+
+  // the other side is usually a few instructions away, do not sleep at once
+  for (int i = 0; i < spin_count; ++i) {
+    if (load_acquire(idx) != seen) return 0;
+    cpu_relax();
+  }
+
+  __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(idx, __ATOMIC_SEQ_CST) == seen && !__atomic_load_n(closed, __ATOMIC_SEQ_CST)) {
+    ret = (int) syscall(SYS_futex, idx, FUTEX_WAIT_BITSET | futex_flag, seen, deadline, NULL,
+                        FUTEX_BITSET_MATCH_ANY);
+  }
+  __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+
+  return (ret < 0 && errno == ETIMEDOUT) ? -1 : 0;
+}
+
+static inline void spsc_wake(int32_t *idx, uint32_t *waiting, int futex_flag)
+{
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  // one wake per sleep, the waiter raises the flag again before sleeping
+  if (__atomic_load_n(waiting, __ATOMIC_RELAXED) && __atomic_exchange_n(waiting, 0, __ATOMIC_RELAXED)) {
+    syscall(SYS_futex, idx, FUTEX_WAKE | futex_flag, 1, NULL, NULL, 0);
+  }
+}
+
+/**
+ * A waiter may have seen closed unset just before it went to sleep on an
+ * index that will not move any more, keep waking it until it is out.
+ */
+static void spsc_close(queue_t *q)
+{
+  while (__atomic_load_n(&q->push_wait, __ATOMIC_SEQ_CST) || __atomic_load_n(&q->pop_wait, __ATOMIC_SEQ_CST)) {
+    syscall(SYS_futex, &q->r, FUTEX_WAKE | FUTEX_FLAG(q), INT32_MAX, NULL, NULL, 0);
+    syscall(SYS_futex, &q->f, FUTEX_WAKE | FUTEX_FLAG(q), INT32_MAX, NULL, NULL, 0);
+    sched_yield();
+  }
+}
+
+/**
+ * wait until the producer has a free slot, return the current consumer index
+ */
+static queue_ret_t spsc_wait_free(queue_t *q, int32_t f, int32_t *r, const struct timespec *deadline)
+{
+  *r = load_acquire(&q->r);
+  if (ring_next(q, f) != *r) return QUEUE_OK;
+
+  if ((q->flag & QUEUE_BLOCK) == 0) return QUEUE_FULL;
+
+  while (ring_next(q, f) == *r) {
+    if (spsc_wait(&q->r, *r, &q->push_wait, &q->closed, FUTEX_FLAG(q), deadline) < 0) {
+      LOGD("queue(%s) block timeout", q->name);
+      return QUEUE_TIMEOUT;
     }
+    if (load_acquire(&q->closed)) return QUEUE_CLOSED;
+    *r = load_acquire(&q->r);
+  }
+
+  return QUEUE_OK;
+}
+
+static queue_ret_t spsc_push(queue_t *q, void *data, const struct timespec *deadline, push_fn cb)
+{
+  int32_t f = q->f, r;
+  queue_ret_t ret;
+
+  if (QUEUE_OK != (ret = spsc_wait_free(q, f, &r, deadline))) return ret;
+
+  if (cb == NULL) {
+    memcpy((QUEUE_DATA(q) + f * q->size), data, q->size);
+  } else if (cb(data, q, QUEUE_DATA(q) + f * q->size, q->size) < 0) {
+    LOGE("queue(%s) pushed cb %d fail. cancel.", q->name, q->size);
+    return QUEUE_OK;
+  }
+
+  store_release(&q->f, ring_next(q, f));
+  spsc_wake(&q->f, &q->pop_wait, FUTEX_FLAG(q));
+  QUEUE_NOTIFY(q);
+
+  return QUEUE_OK;
+}
+
+/**
+ * wait until the consumer has an element, return the current producer index
+ */
+static queue_ret_t spsc_wait_used(queue_t *q, int32_t r, int32_t *f, const struct timespec *deadline)
+{
+  *f = load_acquire(&q->f);
+  if (r != *f) return QUEUE_OK;
+
+  if ((q->flag & QUEUE_BLOCK) == 0) return load_acquire(&q->closed) ? QUEUE_CLOSED : QUEUE_EMPTY;
+
+  while (r == *f) {
+    // the producer is done once closed, take what it left before stopping
+    if (load_acquire(&q->closed)) {
+      *f = load_acquire(&q->f);
+      return r == *f ? QUEUE_CLOSED : QUEUE_OK;
+    }
+    if (spsc_wait(&q->f, *f, &q->pop_wait, &q->closed, FUTEX_FLAG(q), deadline) < 0) {
+      LOGD("queue(%s) block timeout", q->name);
+      return QUEUE_TIMEOUT;
+    }
+    *f = load_acquire(&q->f);
+  }
+
+  return QUEUE_OK;
+}
+
+static queue_ret_t spsc_pop(queue_t *q, void **data, uint32_t *len, const struct timespec *deadline)
+{
+  int32_t r = q->r, f;
+  queue_ret_t ret;
+
+  if (QUEUE_OK != (ret = spsc_wait_used(q, r, &f, deadline))) return ret;
+
+  *data = ((void **) (QUEUE_DATA(q) + r * q->size));
+  if (NULL != len) *len = q->size;
+
+  store_release(&q->r, ring_next(q, r));
+  spsc_wake(&q->r, &q->push_wait, FUTEX_FLAG(q));
+
+  return QUEUE_OK;
+}
+
+#endif
+
 
-    if (NULL == t) {
+/**
+ * with the mutex held, wait until there is a free slot
+ */
+static queue_ret_t wait_not_full(queue_t *q, const struct timespec *deadline)
+{
+  if (!QUEUE_IS_FULL(q)) return QUEUE_OK;
 
-      LOGD("queue(%s) infinite blocking", q->name);
+  LOGD("queue(%s) is full, block it", q->name);
 
-      while (QUEUE_IS_FULL(q)) {
-        pthread_cond_wait(&q->lock.push_cond, &q->lock.mutex);
-      }
+  if ((q->flag & QUEUE_BLOCK) == 0) return QUEUE_FULL;
 
-    } else {
-      struct timespec tsp;
-      struct timeval now;
-      gettimeofday(&now, NULL);
-      tsp.tv_sec = now.tv_sec + t->tv_sec;
-      tsp.tv_nsec = now.tv_usec * 1000 + t->tv_nsec;
+  while (QUEUE_IS_FULL(q)) {
+    if (q->closed) return QUEUE_CLOSED;
+    if (NULL == deadline) {
+      pthread_cond_wait(&q->lock.push_cond, &q->lock.mutex);
+    } else if (ETIMEDOUT == pthread_cond_timedwait(&q->lock.push_cond, &q->lock.mutex, deadline)
+               && QUEUE_IS_FULL(q)) {
+      LOGD("queue(%s) block timeout", q->name);
+      return QUEUE_TIMEOUT;
+    }
+  }
 
-      LOGD("queue(%s) block %d sec", q->name, t->tv_sec);
+  return QUEUE_OK;
+}
 
-      if (0 != pthread_cond_timedwait(&q->lock.push_cond, &q->lock.mutex, &tsp)) {
-        LOGD("queue(%s) block timeout", q->name);
-        pthread_mutex_unlock(&q->lock.mutex);
-        return QUEUE_TIMEOUT;
-      }
+/**
+ * with the mutex held, wait until there is an element
+ */
+static queue_ret_t wait_not_empty(queue_t *q, const struct timespec *deadline)
+{
+  if (!QUEUE_IS_EMPTY(q)) return QUEUE_OK;
+  if (q->closed) return QUEUE_CLOSED;
+
+  LOGD("queue(%s) is empty, block it", q->name);
+
+  if ((q->flag & QUEUE_BLOCK) == 0) return QUEUE_EMPTY;
+
+  while (QUEUE_IS_EMPTY(q)) {
+    if (q->closed) return QUEUE_CLOSED;
+    if (NULL == deadline) {
+      pthread_cond_wait(&q->lock.pop_cond, &q->lock.mutex);
+    } else if (ETIMEDOUT == pthread_cond_timedwait(&q->lock.pop_cond, &q->lock.mutex, deadline)
+               && QUEUE_IS_EMPTY(q)) {
+      LOGD("queue(%s) block timeout", q->name);
+      return QUEUE_TIMEOUT;
     }
+  }
+
+  return QUEUE_OK;
+}
+
+/**
+ * consecutive slots from the producer index up to the end of the ring
+ */
+static inline uint32_t contiguous_free(const queue_t *q, int32_t f, int32_t r)
+{
+  uint32_t count = (r > f ? r - f : q->len - f + r) - 1;
+
+  return count > q->len - f ? q->len - f : count;
+}
+
+/**
+ * consecutive elements from the consumer index up to the end of the ring
+ */
+static inline uint32_t contiguous_used(const queue_t *q, int32_t f, int32_t r)
+{
+  return f >= r ? f - r : q->len - r;
+}
+
+static inline uint32_t free_slots(const queue_t *q, int32_t f, int32_t r)
+{
+  return (r > f ? r - f : q->len - f + r) - 1;
+}
+
+static inline uint32_t used_slots(const queue_t *q, int32_t f, int32_t r)
+{
+  return f >= r ? f - r : q->len - r + f;
+}
 
-  } // end if (QUEUE_IS_FULL(q))
+static inline void count_drop(queue_t *q, uint32_t count)
+{
+  q->dropped += count;
+  if (NULL != q->drop_counter) {
+    __atomic_add_fetch(q->drop_counter, count * q->size, __ATOMIC_RELAXED);
+  }
+  LOGD("queue(%s) dropped %d, total %d", q->name, count, q->dropped);
+}
+
+/**
+ * hand count dropped elements, from index i of the ring on, to drop_cb
+ */
+static void drop_ring(const queue_t *q, int32_t i, uint32_t count)
+{
+  if (NULL == q->drop_cb) return;
+
+  for (; count; --count, i = i + 1 == (int32_t) q->len ? 0 : i + 1)
+    q->drop_cb(QUEUE_DATA(q) + i * q->size, q->drop_arg);
+}
+
+/**
+ * hand count dropped elements of the producer's data to drop_cb
+ */
+static void drop_data(const queue_t *q, const void *data, uint32_t count)
+{
+  if (NULL == q->drop_cb) return;
+
+  for (uint32_t i = 0; i < count; ++i)
+    q->drop_cb(data + i * q->size, q->drop_arg);
+}
+
+/**
+ * with the mutex held, free up to want slots by the drop policy without
+ * waking anyone, return the slots freed. Held elements are never evicted.
+ */
+static uint32_t evict(queue_t *q, uint32_t want)
+{
+  uint32_t n = used_slots(q, q->f, q->r) - q->held;
+
+  if (want < n) n = want;
+  if (0 == n) return 0;
+
+  if (q->flag & QUEUE_OVERWRITE) {
+    q->f = q->f >= n ? q->f - (int32_t) n : q->f + (int32_t) (q->len - n);
+    drop_ring(q, q->f, n);
+  } else if (0 == q->held) {
+    drop_ring(q, q->r, n);
+    q->r = (int32_t) ((q->r + n) % q->len);
+  } else {
+    // the oldest elements are being read
+    return 0;
+  }
+
+  count_drop(q, n);
+
+  return n;
+}
+
+/**
+ * copy count elements into the ring at index f, wrapping around its end
+ */
+static void copy_in(queue_t *q, int32_t f, const void *data, uint32_t count)
+{
+  uint32_t n = count > q->len - f ? q->len - f : count;
+
+  memcpy(QUEUE_DATA(q) + f * q->size, data, n * q->size);
+  if (n < count) memcpy(QUEUE_DATA(q), data + n * q->size, (count - n) * q->size);
+}
+
+/**
+ * copy count elements out of the ring from index r, wrapping around its end
+ */
+static void copy_out(const queue_t *q, int32_t r, void *data, uint32_t count)
+{
+  uint32_t n = count > q->len - r ? q->len - r : count;
+
+  memcpy(data, QUEUE_DATA(q) + r * q->size, n * q->size);
+  if (n < count) memcpy(data + n * q->size, QUEUE_DATA(q), (count - n) * q->size);
+}
+
+queue_ret_t queue_close(queue_t *q)
+{
+  if (NULL == q) return QUEUE_NOT_EXIST;
+
+  queue_lock_init(q);
+  pthread_mutex_lock(&q->lock.mutex);
+  __atomic_store_n(&q->closed, 1, __ATOMIC_SEQ_CST);
+  pthread_cond_broadcast(&q->lock.push_cond);
+  pthread_cond_broadcast(&q->lock.pop_cond);
+  pthread_mutex_unlock(&q->lock.mutex);
+
+#ifdef __linux__
+  if (q->flag & QUEUE_SPSC) spsc_close(q);
+#endif
+  QUEUE_NOTIFY(q);
+
+  return QUEUE_OK;
+}
+
+queue_ret_t queue_push(queue_t *q, void *data, struct timespec *t, push_fn cb)
+{
+  struct timespec deadline;
+  queue_ret_t ret;
+
+  if (NULL == q) return QUEUE_NOT_EXIST;
+  if (load_acquire(&q->closed)) return QUEUE_CLOSED;
+
+#ifdef __linux__
+  if (q->flag & QUEUE_SPSC) return spsc_push(q, data, queue_deadline(&deadline, t), cb);
+#endif
+
+  queue_lock_init(q);
+  pthread_mutex_lock(&q->lock.mutex);
+
+  if (QUEUE_IS_FULL(q) && (q->flag & QUEUE_DROP_POLICY) && 0 == evict(q, 1)) {
+    count_drop(q, 1);
+    // what a push_fn would have made of it is unknown
+    if (NULL == cb) drop_data(q, data, 1);
+    pthread_mutex_unlock(&q->lock.mutex);
+    return QUEUE_FULL;
+  }
+
+  if (QUEUE_OK != (ret = wait_not_full(q, queue_deadline(&deadline, t)))) {
+    pthread_mutex_unlock(&q->lock.mutex);
+    return ret;
+  }
 
   if (cb == NULL) {
-    memcpy((q->data + q->f * q->size), data, q->size);
-  } else if (cb(data, q, q->data + q->f * q->size, q->size) < 0) {
+    memcpy((QUEUE_DATA(q) + q->f * q->size), data, q->size);
+  } else if (cb(data, q, QUEUE_DATA(q) + q->f * q->size, q->size) < 0) {
     LOGE("queue(%s) pushed cb %d fail, length %d. cancel.", q->name, q->size, queue_len(q));
     pthread_mutex_unlock(&q->lock.mutex);
     return QUEUE_OK;
@@ -190,12 +785,15 @@ queue_ret_t queue_push(queue_t *q, void *data, struct timespec *t, push_fn cb)
 
   pthread_cond_signal(&q->lock.pop_cond);
   pthread_mutex_unlock(&q->lock.mutex);
+  QUEUE_NOTIFY(q);
 
   return QUEUE_OK;
 }
 
-queue_ret_t queue_pop(queue_t *q, void **data, uint32_t *len, struct timespec *timeout)
+queue_ret_t queue_pop_until(queue_t *q, void **data, uint32_t *len, const struct timespec *deadline)
 {
+  queue_ret_t ret;
+
   if (NULL == q) {
     LOGW("queue not exists while pop");
     return QUEUE_NOT_EXIST;
@@ -205,52 +803,345 @@ queue_ret_t queue_pop(queue_t *q, void **data, uint32_t *len, struct timespec *t
     return QUEUE_PARAM_ERROR;
   }
 
+#ifdef __linux__
+  if (q->flag & QUEUE_SPSC) return spsc_pop(q, data, len, deadline);
+#endif
+
   queue_lock_init(q);
 
   pthread_mutex_lock(&q->lock.mutex);
 
-  if (QUEUE_IS_EMPTY(q)) {
-    LOGD("queue(%s) is empty, block it", q->name);
+  if (QUEUE_OK != (ret = wait_not_empty(q, deadline))) {
+    pthread_mutex_unlock(&q->lock.mutex);
+    return ret;
+  }
+
+  *data = ((void **) (QUEUE_DATA(q) + q->r * q->size));
+
+  if (++q->r >= q->len) {
+    q->r = 0;
+  }
+  if (NULL != len) *len = q->size;
+
+  LOGD("queue(%s) poped %d sucess, queue length %d", q->name, q->size, queue_len(q));
+
+  pthread_cond_signal(&q->lock.push_cond);
+  pthread_mutex_unlock(&q->lock.mutex);
+
+  return QUEUE_OK;
+}
 
-    if ((q->flag & QUEUE_BLOCK) == 0) {
+queue_ret_t queue_pop(queue_t *q, void **data, uint32_t *len, struct timespec *timeout)
+{
+  struct timespec deadline;
+
+  return queue_pop_until(q, data, len, queue_deadline(&deadline, timeout));
+}
+
+queue_ret_t queue_push_n(queue_t *q, const void *data, uint32_t *count, struct timespec *timeout)
+{
+  struct timespec deadline;
+  const struct timespec *until = queue_deadline(&deadline, timeout);
+  queue_ret_t ret;
+  uint32_t n, pushed;
+  int32_t f;
+
+  if (NULL == q) return QUEUE_NOT_EXIST;
+  if (NULL == data || NULL == count) return QUEUE_PARAM_ERROR;
+  if (0 == *count) return QUEUE_OK;
+  if (load_acquire(&q->closed)) return QUEUE_CLOSED;
+
+#ifdef __linux__
+  if (q->flag & QUEUE_SPSC) {
+    int32_t r;
+
+    f = q->f;
+    if (QUEUE_OK != (ret = spsc_wait_free(q, f, &r, until))) return ret;
+
+    n = free_slots(q, f, r);
+    if (*count < n) n = *count;
+    copy_in(q, f, data, n);
+
+    f += (int32_t) n;
+    store_release(&q->f, f >= q->len ? f - q->len : f);
+    spsc_wake(&q->f, &q->pop_wait, FUTEX_FLAG(q));
+    QUEUE_NOTIFY(q);
+
+    *count = n;
+    return QUEUE_OK;
+  }
+#endif
+
+  queue_lock_init(q);
+  pthread_mutex_lock(&q->lock.mutex);
+
+  n = free_slots(q, q->f, q->r);
+  if (n < *count && (q->flag & QUEUE_DROP_POLICY)) {
+    n += evict(q, *count - n);
+    if (n < *count) {
+      // no room for all of them, keep the newest
+      count_drop(q, *count - n);
+      drop_data(q, data, *count - n);
+      data += (*count - n) * q->size;
+    }
+    if (0 == n) {
       pthread_mutex_unlock(&q->lock.mutex);
-      return QUEUE_EMPTY;
+      return QUEUE_FULL;
     }
+    // every element is either queued or dropped
+    pushed = *count;
+  } else {
+    if (QUEUE_OK != (ret = wait_not_full(q, until))) {
+      pthread_mutex_unlock(&q->lock.mutex);
+      return ret;
+    }
+    n = free_slots(q, q->f, q->r);
+    if (*count < n) n = *count;
+    pushed = n;
+  }
+  copy_in(q, q->f, data, n);
+
+  f = q->f + (int32_t) n;
+  q->f = f >= q->len ? f - q->len : f;
+
+  LOGD("queue(%s) pushed %d x %d sucess, length %d", q->name, n, q->size, queue_len(q));
+
+  if (n > 1) pthread_cond_broadcast(&q->lock.pop_cond);
+  else pthread_cond_signal(&q->lock.pop_cond);
+  pthread_mutex_unlock(&q->lock.mutex);
+  QUEUE_NOTIFY(q);
+
+  *count = pushed;
+  return QUEUE_OK;
+}
+
+queue_ret_t queue_pop_n(queue_t *q, void *data, uint32_t *count, struct timespec *timeout)
+{
+  struct timespec deadline;
+  const struct timespec *until = queue_deadline(&deadline, timeout);
+  queue_ret_t ret;
+  uint32_t n;
+  int32_t r;
+
+  if (NULL == q) return QUEUE_NOT_EXIST;
+  if (NULL == data || NULL == count) return QUEUE_PARAM_ERROR;
+  if (0 == *count) return QUEUE_OK;
+
+#ifdef __linux__
+  if (q->flag & QUEUE_SPSC) {
+    int32_t f;
+
+    r = q->r;
+    if (QUEUE_OK != (ret = spsc_wait_used(q, r, &f, until))) return ret;
+
+    n = used_slots(q, f, r);
+    if (*count < n) n = *count;
+    copy_out(q, r, data, n);
+
+    r += (int32_t) n;
+    store_release(&q->r, r >= q->len ? r - q->len : r);
+    spsc_wake(&q->r, &q->push_wait, FUTEX_FLAG(q));
+
+    *count = n;
+    return QUEUE_OK;
+  }
+#endif
+
+  queue_lock_init(q);
+  pthread_mutex_lock(&q->lock.mutex);
+
+  if (QUEUE_OK != (ret = wait_not_empty(q, until))) {
+    pthread_mutex_unlock(&q->lock.mutex);
+    return ret;
+  }
+
+  n = used_slots(q, q->f, q->r);
+  if (*count < n) n = *count;
+  copy_out(q, q->r, data, n);
+
+  r = q->r + (int32_t) n;
+  q->r = r >= q->len ? r - q->len : r;
+
+  LOGD("queue(%s) poped %d x %d sucess, queue length %d", q->name, n, q->size, queue_len(q));
+
+  if (n > 1) pthread_cond_broadcast(&q->lock.push_cond);
+  else pthread_cond_signal(&q->lock.push_cond);
+  pthread_mutex_unlock(&q->lock.mutex);
+
+  *count = n;
+  return QUEUE_OK;
+}
+
+queue_ret_t queue_reserve(queue_t *q, void **data, uint32_t *count, struct timespec *timeout)
+{
+  struct timespec deadline;
+  const struct timespec *until = queue_deadline(&deadline, timeout);
+  queue_ret_t ret;
+  uint32_t n;
+
+  if (NULL == q) return QUEUE_NOT_EXIST;
+  if (NULL == data) return QUEUE_PARAM_ERROR;
+  if (load_acquire(&q->closed)) return QUEUE_CLOSED;
+
+#ifdef __linux__
+  if (q->flag & QUEUE_SPSC) {
+    int32_t r;
+
+    if (QUEUE_OK != (ret = spsc_wait_free(q, q->f, &r, until))) return ret;
+    n = contiguous_free(q, q->f, r);
+    goto reserved;
+  }
+#endif
+
+  queue_lock_init(q);
+  pthread_mutex_lock(&q->lock.mutex);
+
+  // a spare slot reserved before and committed with 0 is given up
+  q->dropping = 0;
+
+  // evict one at a time, the producer may commit fewer than it asks for
+  if (QUEUE_IS_FULL(q) && (q->flag & QUEUE_DROP_POLICY) && 0 == evict(q, 1)) {
+    // nowhere to put it, the producer fills the spare slot and it is dropped on commit
+    q->dropping = 1;
+    pthread_mutex_unlock(&q->lock.mutex);
+    if (NULL != count) *count = 1;
+    *data = QUEUE_DATA(q) + q->len * q->size;
+    return QUEUE_OK;
+  }
+
+  if (QUEUE_OK != (ret = wait_not_full(q, until))) {
+    pthread_mutex_unlock(&q->lock.mutex);
+    return ret;
+  }
+  n = contiguous_free(q, q->f, q->r);
+
+  pthread_mutex_unlock(&q->lock.mutex);
+
+#ifdef __linux__
+reserved:
+#endif
+  if (NULL != count) *count = (*count && *count < n) ? *count : n;
+  *data = QUEUE_DATA(q) + q->f * q->size;
+
+  return QUEUE_OK;
+}
+
+queue_ret_t queue_commit(queue_t *q, uint32_t count)
+{
+  int32_t f;
+
+  if (NULL == q) return QUEUE_NOT_EXIST;
+
+#ifdef __linux__
+  if (q->flag & QUEUE_SPSC) {
+    if (0 == count) return QUEUE_OK;
+    f = q->f + (int32_t) count;
+    store_release(&q->f, f >= q->len ? f - q->len : f);
+    spsc_wake(&q->f, &q->pop_wait, FUTEX_FLAG(q));
+    QUEUE_NOTIFY(q);
+    return QUEUE_OK;
+  }
+#endif
+
+  queue_lock_init(q);
+  pthread_mutex_lock(&q->lock.mutex);
 
-    if (NULL == timeout) {
-      LOGD("queue(%s) infinite blocking", q->name);
-      while (QUEUE_IS_EMPTY(q)) {
-        pthread_cond_wait(&q->lock.pop_cond, &q->lock.mutex);
-      }
-    } else {
-      struct timespec tsp;
-      struct timeval now;
-      gettimeofday(&now, NULL);
-      tsp.tv_sec = now.tv_sec + timeout->tv_sec;
-      tsp.tv_nsec = now.tv_usec * 1000 + timeout->tv_nsec;
-
-      LOGD("queue(%s) block %d sec", q->name, timeout->tv_sec);
-
-      if (0 != pthread_cond_timedwait(&q->lock.pop_cond, &q->lock.mutex, &tsp)) {
-        LOGD("queue(%s) block timeout", q->name);
-        pthread_mutex_unlock(&q->lock.mutex);
-        return QUEUE_TIMEOUT;
-      }
+  // only the spare slot of queue_reserve() is dropped, and only if it was filled
+  if (q->dropping) {
+    q->dropping = 0;
+    if (count) {
+      count_drop(q, 1);
+      drop_data(q, QUEUE_DATA(q) + q->len * q->size, 1);
     }
+    pthread_mutex_unlock(&q->lock.mutex);
+    return QUEUE_OK;
+  }
+  if (0 == count) {
+    pthread_mutex_unlock(&q->lock.mutex);
+    return QUEUE_OK;
+  }
 
-  } // end if (QUEUE_IS_FULL(q))
+  f = q->f + (int32_t) count;
+  q->f = f >= q->len ? f - q->len : f;
+  LOGD("queue(%s) committed %d x %d, length %d", q->name, count, q->size, queue_len(q));
 
-  *data = ((void **) (q->data + q->r * q->size));
+  if (count > 1) pthread_cond_broadcast(&q->lock.pop_cond);
+  else pthread_cond_signal(&q->lock.pop_cond);
+  pthread_mutex_unlock(&q->lock.mutex);
+  QUEUE_NOTIFY(q);
 
-  if (++q->r >= q->len) {
-    q->r = 0;
+  return QUEUE_OK;
+}
+
+queue_ret_t queue_peek(queue_t *q, void **data, uint32_t *count, struct timespec *timeout)
+{
+  struct timespec deadline;
+  const struct timespec *until = queue_deadline(&deadline, timeout);
+  queue_ret_t ret;
+  uint32_t n;
+
+  if (NULL == q) return QUEUE_NOT_EXIST;
+  if (NULL == data) return QUEUE_PARAM_ERROR;
+
+#ifdef __linux__
+  if (q->flag & QUEUE_SPSC) {
+    int32_t f;
+
+    if (QUEUE_OK != (ret = spsc_wait_used(q, q->r, &f, until))) return ret;
+    n = contiguous_used(q, f, q->r);
+    goto peeked;
   }
-  if (NULL != len) *len = q->size;
+#endif
 
-  LOGD("queue(%s) poped %d sucess, queue length %d", q->name, q->size, queue_len(q));
+  queue_lock_init(q);
+  pthread_mutex_lock(&q->lock.mutex);
+
+  if (QUEUE_OK != (ret = wait_not_empty(q, until))) {
+    pthread_mutex_unlock(&q->lock.mutex);
+    return ret;
+  }
+  n = contiguous_used(q, q->f, q->r);
+  if (NULL != count && *count && *count < n) n = *count;
+  // protected from eviction until released
+  q->held = n;
 
-  pthread_cond_signal(&q->lock.push_cond);
   pthread_mutex_unlock(&q->lock.mutex);
 
+#ifdef __linux__
+peeked:
+#endif
+  if (NULL != count) *count = (*count && *count < n) ? *count : n;
+  *data = QUEUE_DATA(q) + q->r * q->size;
+
   return QUEUE_OK;
-}
\ No newline at end of file
+}
+
+queue_ret_t queue_release(queue_t *q, uint32_t count)
+{
+  int32_t r;
+
+  if (NULL == q) return QUEUE_NOT_EXIST;
+  if (0 == count) return QUEUE_OK;
+
+#ifdef __linux__
+  if (q->flag & QUEUE_SPSC) {
+    r = q->r + (int32_t) count;
+    store_release(&q->r, r >= q->len ? r - q->len : r);
+    spsc_wake(&q->r, &q->push_wait, FUTEX_FLAG(q));
+    return QUEUE_OK;
+  }
+#endif
+
+  pthread_mutex_lock(&q->lock.mutex);
+
+  r = q->r + (int32_t) count;
+  q->r = r >= q->len ? r - q->len : r;
+  q->held = q->held > count ? q->held - count : 0;
+  LOGD("queue(%s) released %d x %d, length %d", q->name, count, q->size, queue_len(q));
+
+  if (count > 1) pthread_cond_broadcast(&q->lock.push_cond);
+  else pthread_cond_signal(&q->lock.push_cond);
+  pthread_mutex_unlock(&q->lock.mutex);
+
+  return QUEUE_OK;
+}
@@ -22,13 +22,14 @@
 
 #include <stdint.h>
 #include <pthread.h>
+#include "wakeup.h"
 
 
+#define QUEUE_CACHE_LINE  64
+
 typedef struct queue_s
 {
     char name[16];
-    int32_t f;
-    int32_t r;
     struct
     {
         uint32_t inited;
@@ -45,10 +46,34 @@ typedef struct queue_s
 
     uint32_t flag;
     void *data;
-} queue_t;
+    // shared queue: ring offset from the control block instead of data
+    uint32_t data_offset;
+    // set by queue_close(): no more pushes, pops take what is left
+    uint32_t closed;
+
+    /* producer and consumer index live on their own cache lines */
+    int32_t f __attribute__((aligned(QUEUE_CACHE_LINE)));
+    uint32_t push_wait;
+    // elements lost to the drop policy
+    uint32_t dropped;
+    // producer filling the spare slot, its elements are dropped on commit
+    uint32_t dropping;
+    // optional dropped bytes counter, for the queue as a whole
+    uint32_t *drop_counter;
+    // optional, told about every dropped element, e.g. to find its source
+    void (*drop_cb)(const void *data, void *arg);
+    void *drop_arg;
+    // optional fd to poke on every push or commit
+    wakeup_t *wakeup;
+    int32_t r __attribute__((aligned(QUEUE_CACHE_LINE)));
+    uint32_t pop_wait;
+    // elements the consumer still holds after queue_peek()
+    uint32_t held;
+} __attribute__((aligned(QUEUE_CACHE_LINE))) queue_t;
 
 typedef enum queue_ret_e
 {
+    QUEUE_CLOSED = -4,
     QUEUE_TIMEOUT = -3,
     QUEUE_PARAM_ERROR = -2,
     QUEUE_NOT_EXIST = -1,
@@ -63,16 +88,38 @@ typedef enum queue_flag_e
     QUEUE_BLOCK = 1,
     QUEUE_PTR_DATA = 2,
     QUEUE_NEVER_TIMEOUT = 4,
+    /**
+     * exactly one producer and one consumer thread: wait-free ring with
+     * acquire/release indices, a side only sleeps on a futex when it has to
+     */
+    QUEUE_SPSC = 8,
+    /**
+     * never block the producer when full: evict the oldest element and
+     * append. Elements held by the consumer are never evicted, the incoming
+     * one is dropped instead.
+     */
+    QUEUE_DROP_OLDEST = 16,
+    /**
+     * never block the producer when full: overwrite the newest element
+     */
+    QUEUE_OVERWRITE = 32,
+    /**
+     * control block and ring live in a memfd mapping shared between
+     * processes, set by queue_create_shared()
+     */
+    QUEUE_SHARED = 64,
 } queue_flag_t;
 
+#define QUEUE_DROP_POLICY   (QUEUE_DROP_OLDEST | QUEUE_OVERWRITE)
+
 #define QUEUE_IS_EMPTY(q) \
     ((q)->f == (q)->r)
 
 #define QUEUE_IS_FULL(q) \
     ((q)->f == (q)->r - 1 || (q)->f == (q)->r + (q)->len - 1)
 
-#define queue_create_ptr(length, flag)  \
-    queue_create(sizeof(void*), (length), QUEUE_PTR_DATA | (flag))
+#define queue_create_ptr(name, length, flag)  \
+    queue_create((name), sizeof(void*), (length), QUEUE_PTR_DATA | (flag))
 
 #define queue_callback_push(q, cb, arg, timeout) \
     queue_push(q, arg, timeout, cb)
@@ -84,14 +131,111 @@ typedef int (*push_fn)(void *__restrict arg, queue_t *__restrict q, void *__rest
 
 queue_t *queue_create(const char *name, uint32_t data_size, uint32_t length, queue_flag_t flag);
 
+/**
+ * Create a queue in a memfd mapping, another process attaches it with
+ * queue_attach_shared() on the fd (e.g. passed with SCM_RIGHTS) and
+ * peeks elements in place. QUEUE_PTR_DATA is not allowed.
+ *
+ * @param fd out: the memfd, owned by the caller
+ */
+queue_t *queue_create_shared(const char *name, uint32_t data_size, uint32_t length, queue_flag_t flag, int *fd);
+
+queue_t *queue_attach_shared(int fd);
+
+/**
+ * Shut a queue down for good. Pushes and reserves fail with QUEUE_CLOSED,
+ * every blocked waiter wakes up, pops and peeks still hand out what was
+ * queued and return QUEUE_CLOSED once it is empty. A reservation made
+ * before can still be committed. It does not free anything.
+ */
+queue_ret_t queue_close(queue_t *q);
+
+/**
+ * free a queue, a shared one is only unmapped from this process
+ */
 queue_ret_t queue_destory(queue_t *q);
 
+/**
+ * add the bytes of every dropped element to *counter, NULL to stop
+ */
+queue_ret_t queue_set_drop_counter(queue_t *q, uint32_t *counter);
+
+typedef void (*queue_drop_fn)(const void *data, void *arg);
+
+/**
+ * Call cb with every element the drop policy throws away, before its slot
+ * is reused, e.g. to charge speaker_statistic_t.drop of its source. It
+ * runs with the queue lock held, NULL to stop.
+ */
+queue_ret_t queue_set_drop_cb(queue_t *q, queue_drop_fn cb, void *arg);
+
+/**
+ * Also signal w whenever elements are pushed or committed, so a consumer
+ * can wait for the queue in the same epoll/select as its sockets. Signals
+ * coalesce: after a wakeup, pop until QUEUE_EMPTY. NULL to stop.
+ */
+queue_ret_t queue_set_wakeup(queue_t *q, wakeup_t *w);
+
 queue_ret_t queue_is_full(queue_t *q);
 
 queue_ret_t queue_is_empty(queue_t *q);
 
+queue_ret_t queue_is_closed(const queue_t *q);
+
+/**
+ * Busy wait up to spins rounds for an element without taking the lock or
+ * sleeping, for a consumer that spends a core on wakeup latency before it
+ * parks in a blocking pop or peek.
+ *
+ * @return QUEUE_OK once not empty, QUEUE_EMPTY when the spins ran out
+ */
+queue_ret_t queue_spin_not_empty(const queue_t *q, uint32_t spins);
+
 queue_ret_t queue_push(queue_t *q, void *__restrict data, struct timespec *timeout, push_fn cb);
 
 queue_ret_t queue_pop(queue_t *q, void **__restrict data, uint32_t *len, struct timespec *timeout);
 
+/**
+ * queue_pop() blocking until an absolute deadline instead of for a timeout.
+ * The deadline is on CLOCK_MONOTONIC (CLOCK_REALTIME where the condition
+ * clock can not be chosen), NULL blocks forever.
+ */
+queue_ret_t queue_pop_until(queue_t *q, void **__restrict data, uint32_t *len, const struct timespec *deadline);
+
+/**
+ * Copy up to count elements in with one lock and one wakeup.
+ *
+ * @param count in: elements in data, out: elements pushed, at least one
+ */
+queue_ret_t queue_push_n(queue_t *q, const void *__restrict data, uint32_t *count, struct timespec *timeout);
+
+/**
+ * Copy up to count elements out with one lock and one wakeup.
+ *
+ * @param count in: room in data, out: elements popped, at least one
+ */
+queue_ret_t queue_pop_n(queue_t *q, void *__restrict data, uint32_t *count, struct timespec *timeout);
+
+/**
+ * Zero-copy producer side: get consecutive free slots, fill them outside of
+ * any lock, then publish the first count of them with queue_commit().
+ * Only one producer may hold a reservation at a time.
+ *
+ * @param count in: most slots wanted (0 for all), out: slots reserved, at least one
+ */
+queue_ret_t queue_reserve(queue_t *q, void **__restrict data, uint32_t *count, struct timespec *timeout);
+
+queue_ret_t queue_commit(queue_t *q, uint32_t count);
+
+/**
+ * Zero-copy consumer side: get consecutive elements in place, they stay
+ * owned by the consumer until queue_release() and are never overwritten
+ * meanwhile. Only one consumer may peek at a time.
+ *
+ * @param count in: most elements wanted (0 for all), out: elements peeked, at least one
+ */
+queue_ret_t queue_peek(queue_t *q, void **__restrict data, uint32_t *count, struct timespec *timeout);
+
+queue_ret_t queue_release(queue_t *q, uint32_t count);
+
 #endif //BLOCK_QUEUE_H
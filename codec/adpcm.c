@@ -0,0 +1,229 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <string.h>
+#include "adpcm.h"
+#include "../error.h"
+
+#define ADPCM_INDEX_MAX 88
+
+static const int32_t step_table[ADPCM_INDEX_MAX + 1] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+    19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+    130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+    5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int32_t index_table[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+int adpcm_sample_size(audio_bits_t bits)
+{
+  switch (bits) {
+    case BIT_16:
+      return 2;
+    case BIT_20:
+    case BIT_24:
+      return 3;
+    default:
+      return 0;
+  }
+}
+
+static inline int32_t clamp(int32_t v, int32_t lo, int32_t hi)
+{
+  return v < lo ? lo : v > hi ? hi : v;
+}
+
+/**
+ * one frame of all channels, written without branches so the channel
+ * loop can be vectorized: gcc 12 does it at -O3 (-fopt-info-vec), the
+ * step_table lookup done lane by lane, and leaves it scalar at -O2
+ */
+static inline void encode_frame(uint8_t *code, const int16_t *s, int32_t *pred, int32_t *index, int channels)
+{
+  for (int c = 0; c < channels; c++) {
+    int32_t step = step_table[index[c]];
+    int32_t diff = s[c] - pred[c];
+    int32_t sign = diff < 0 ? 8 : 0;
+    int32_t vpdiff = step >> 3, bit;
+
+    diff = diff < 0 ? -diff : diff;
+
+    bit = diff >= step;
+    diff -= bit ? step : 0;
+    vpdiff += bit ? step : 0;
+    int32_t q = bit << 2;
+
+    step >>= 1;
+    bit = diff >= step;
+    diff -= bit ? step : 0;
+    vpdiff += bit ? step : 0;
+    q |= bit << 1;
+
+    step >>= 1;
+    bit = diff >= step;
+    vpdiff += bit ? step : 0;
+    q |= bit;
+
+    pred[c] = clamp(pred[c] + (sign ? -vpdiff : vpdiff), INT16_MIN, INT16_MAX);
+    index[c] = clamp(index[c] + index_table[q], 0, ADPCM_INDEX_MAX);
+    code[c] = (uint8_t) (q | sign);
+  }
+}
+
+static inline int32_t decode_sample(uint8_t code, int32_t *pred, int32_t *index)
+{
+  int32_t step = step_table[*index];
+  int32_t vpdiff = step >> 3;
+
+  if (code & 4) vpdiff += step;
+  if (code & 2) vpdiff += step >> 1;
+  if (code & 1) vpdiff += step >> 2;
+
+  *pred = clamp(*pred + (code & 8 ? -vpdiff : vpdiff), INT16_MIN, INT16_MAX);
+  *index = clamp(*index + index_table[code], 0, ADPCM_INDEX_MAX);
+
+  return *pred;
+}
+
+int adpcm_encode(void *dst, size_t size, const void *src, uint16_t frames, uint8_t channels, audio_bits_t bits,
+                 adpcm_state_t *state)
+{
+  int32_t pred[ADPCM_MAX_CHANNELS], index[ADPCM_MAX_CHANNELS];
+  int16_t s[ADPCM_MAX_CHANNELS];
+  uint8_t code[ADPCM_MAX_CHANNELS];
+  const uint8_t *in = (const uint8_t *) src;
+  uint8_t *out = (uint8_t *) dst;
+  int bytes = adpcm_sample_size(bits);
+  size_t nibble = 0;
+
+  if (bytes == 0 || channels == 0 || channels > ADPCM_MAX_CHANNELS)
+    return ERROR_ARG;
+  if (size < ADPCM_SIZE(frames, channels))
+    return ERROR_ARG;
+
+  out[0] = (uint8_t) frames;
+  out[1] = (uint8_t) (frames >> 8);
+  out[2] = channels;
+  out += 3;
+  for (int c = 0; c < channels; c++) {
+    pred[c] = state[c].predictor;
+    index[c] = state[c].index > ADPCM_INDEX_MAX ? ADPCM_INDEX_MAX : state[c].index;
+    out[0] = (uint8_t) pred[c];
+    out[1] = (uint8_t) (pred[c] >> 8);
+    out[2] = (uint8_t) index[c];
+    out += ADPCM_STATE_SIZE;
+  }
+
+  for (uint32_t i = 0; i < frames; i++) {
+    if (bytes == 2) {
+      memcpy(s, in, (size_t) channels * 2);
+    } else {
+      for (int c = 0; c < channels; c++)
+        s[c] = (int16_t) (in[c * 3 + 1] | in[c * 3 + 2] << 8);
+    }
+    in += (size_t) channels * bytes;
+
+    encode_frame(code, s, pred, index, channels);
+
+    if ((channels & 1) == 0) {
+      // frames start on a byte, pairs of channels make bytes
+      uint8_t *o = out + (nibble >> 1);
+      for (int c = 0; c < channels; c += 2)
+        o[c >> 1] = (uint8_t) (code[c] | code[c + 1] << 4);
+      nibble += channels;
+      continue;
+    }
+    for (int c = 0; c < channels; c++, nibble++) {
+      if (nibble & 1)
+        out[nibble >> 1] |= (uint8_t) (code[c] << 4);
+      else
+        out[nibble >> 1] = code[c];
+    }
+  }
+
+  for (int c = 0; c < channels; c++) {
+    state[c].predictor = (int16_t) pred[c];
+    state[c].index = (uint8_t) index[c];
+  }
+
+  return (int) ADPCM_SIZE(frames, channels);
+}
+
+int adpcm_info(const void *src, size_t src_size, uint16_t *frames, uint8_t *channels)
+{
+  const uint8_t *p = (const uint8_t *) src;
+
+  if (src_size < ADPCM_HEADER_SIZE(0))
+    return ERROR_ARG;
+
+  *frames = (uint16_t) (p[0] | p[1] << 8);
+  *channels = p[2];
+  if (*channels == 0 || *channels > ADPCM_MAX_CHANNELS || src_size < ADPCM_SIZE(*frames, *channels))
+    return ERROR_ARG;
+
+  return OK;
+}
+
+int adpcm_decode(void *dst, size_t size, const void *src, size_t src_size, audio_bits_t bits)
+{
+  int32_t pred[ADPCM_MAX_CHANNELS], index[ADPCM_MAX_CHANNELS], v;
+  const uint8_t *in = (const uint8_t *) src;
+  uint8_t *out = (uint8_t *) dst, code;
+  int bytes = adpcm_sample_size(bits), ret;
+  uint16_t frames;
+  uint8_t channels;
+  size_t nibble = 0;
+
+  if (bytes == 0)
+    return ERROR_ARG;
+  ret = adpcm_info(src, src_size, &frames, &channels);
+  if (ret) return ret;
+  if (size < (size_t) frames * channels * bytes)
+    return ERROR_ARG;
+
+  in += 3;
+  for (int c = 0; c < channels; c++) {
+    pred[c] = (int16_t) (in[0] | in[1] << 8);
+    index[c] = in[2] > ADPCM_INDEX_MAX ? ADPCM_INDEX_MAX : in[2];
+    in += ADPCM_STATE_SIZE;
+  }
+
+  for (uint32_t i = 0; i < frames; i++) {
+    for (int c = 0; c < channels; c++, nibble++) {
+      code = nibble & 1 ? in[nibble >> 1] >> 4 : in[nibble >> 1] & 0x0F;
+      v = decode_sample(code, &pred[c], &index[c]);
+      if (bytes == 3) {
+        *out++ = 0;
+      }
+      *out++ = (uint8_t) v;
+      *out++ = (uint8_t) (v >> 8);
+    }
+  }
+
+  return (int) ((size_t) frames * channels * bytes);
+}
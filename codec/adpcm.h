@@ -0,0 +1,91 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef ADPCM_H
+#define ADPCM_H
+
+#include <stddef.h>
+#include <stdint-gcc.h>
+#include "../audio.h"
+
+/*
+ * IMA ADPCM of COMPRESS_ADPCM packets, 4 bits per sample. Every packet
+ * starts with the predictor state of each channel, so it decodes on its
+ * own and a lost packet costs only its samples.
+
++──────+──────────+──────────+─────────────────────────+──────────────────────────────+
+|      | frames   | channels | state 0 .. channels-1   | codes                        |
++──────+──────────+──────────+─────────────────────────+──────────────────────────────+
+| size | 16       | 8        | 16 predictor, 8 index   | 4 per sample, interleaved    |
++──────+──────────+──────────+─────────────────────────+──────────────────────────────+
+
+ codes are in frame order like the pcm they come from, the low nibble of
+ a byte first
+
+ */
+
+#define ADPCM_MAX_CHANNELS  32
+#define ADPCM_STATE_SIZE    3
+#define ADPCM_HEADER_SIZE(channels) (3 + ADPCM_STATE_SIZE * (size_t) (channels))
+// encoded size of a packet
+#define ADPCM_SIZE(frames, channels) \
+  (ADPCM_HEADER_SIZE(channels) + ((size_t) (frames) * (channels) + 1) / 2)
+
+/**
+ * encoder state of one channel, carried from packet to packet, zero to start
+ */
+typedef struct adpcm_state_s {
+    int16_t predictor;
+    uint8_t index;
+} adpcm_state_t;
+
+/**
+ * bytes of one sample of bits in the pcm, 0 if the codec can not do it
+ * (32 bit integer and float). 20 and 24 bit samples are coded from their
+ * upper 16 bits.
+ */
+int adpcm_sample_size(audio_bits_t bits);
+
+/**
+ * Encode frames of channels interleaved little endian samples of bits.
+ * The channels are coded side by side, so one call for every channel of
+ * a line is cheaper than one per channel.
+ *
+ * @param state channels entries, updated for the next packet
+ * @return bytes written to dst, ADPCM_SIZE(), or ERROR_ARG
+ */
+int adpcm_encode(void *dst, size_t size, const void *src, uint16_t frames, uint8_t channels, audio_bits_t bits,
+                 adpcm_state_t *state);
+
+/**
+ * read frames and channels of an encoded packet, to size the output
+ *
+ * @return OK, or ERROR_ARG
+ */
+int adpcm_info(const void *src, size_t src_size, uint16_t *frames, uint8_t *channels);
+
+/**
+ * Decode an adpcm_encode() packet into interleaved samples of bits.
+ *
+ * @return bytes written to dst, or ERROR_ARG if dst is too small or src
+ *         is truncated
+ */
+int adpcm_decode(void *dst, size_t size, const void *src, size_t src_size, audio_bits_t bits);
+
+#endif //ADPCM_H
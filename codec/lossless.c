@@ -0,0 +1,500 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdbool.h>
+#include <string.h>
+#include "lossless.h"
+#include "../error.h"
+
+#define RICE_ESCAPE     31
+#define RICE_PARAM_BITS 5
+#define MAX_PARTITIONS  (LOSSLESS_MAX_FRAMES / LOSSLESS_PARTITION)
+
+typedef struct bit_writer_s {
+    uint8_t *p;
+    uint64_t acc;
+    int n;
+} bit_writer_t;
+
+typedef struct bit_reader_s {
+    const uint8_t *p, *start, *end;
+    // msb aligned, n bits are valid
+    uint64_t acc;
+    int n;
+} bit_reader_t;
+
+int lossless_sample_size(audio_bits_t bits)
+{
+  switch (bits) {
+    case BIT_16:
+      return 2;
+    case BIT_20:
+    case BIT_24:
+      return 3;
+    default:
+      return 0;
+  }
+}
+
+static inline int32_t read_sample(const uint8_t *p, int bytes)
+{
+  if (bytes == 2)
+    return (int16_t) (p[0] | p[1] << 8);
+  return (int32_t) ((uint32_t) p[0] << 8 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 24) >> 8;
+}
+
+static inline void write_sample(uint8_t *p, int bytes, int32_t v)
+{
+  p[0] = (uint8_t) v;
+  p[1] = (uint8_t) (v >> 8);
+  if (bytes == 3)
+    p[2] = (uint8_t) (v >> 16);
+}
+
+static inline uint32_t zigzag(int32_t v)
+{
+  return ((uint32_t) v << 1) ^ (uint32_t) (v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t u)
+{
+  return (int32_t) (u >> 1) ^ -(int32_t) (u & 1);
+}
+
+static inline int32_t sign_extend(uint32_t v, int bits)
+{
+  return (int32_t) (v << (32 - bits)) >> (32 - bits);
+}
+
+/**
+ * bits <= 32, v has no bits above them
+ */
+static inline void put_bits(bit_writer_t *w, uint32_t v, int bits)
+{
+  w->acc = (w->acc << bits) | v;
+  w->n += bits;
+  while (w->n >= 8) {
+    w->n -= 8;
+    *w->p++ = (uint8_t) (w->acc >> w->n);
+  }
+}
+
+static inline void put_rice(bit_writer_t *w, uint32_t u, int k)
+{
+  uint32_t q = u >> k;
+
+  if (q + 1 + k <= 32) {
+    put_bits(w, (1u << k) | (u & ((1u << k) - 1)), (int) (q + 1 + k));
+    return;
+  }
+  for (; q >= 32; q -= 32)
+    put_bits(w, 0, 32);
+  put_bits(w, 1, (int) q + 1);
+  if (k) put_bits(w, u & ((1u << k) - 1), k);
+}
+
+static inline void put_align(bit_writer_t *w)
+{
+  if (w->n) put_bits(w, 0, 8 - w->n);
+}
+
+static inline void refill(bit_reader_t *r)
+{
+  uint64_t v;
+
+  if (r->end - r->p >= 8) {
+    memcpy(&v, r->p, 8);
+    r->acc |= __builtin_bswap64(v) >> r->n;
+    r->p += (63 - r->n) >> 3;
+    r->n |= 56;
+    return;
+  }
+  // past the end reads zeros, get_overrun() tells
+  while (r->n < 56) {
+    v = r->p < r->end ? *r->p : 0;
+    r->p++;
+    r->acc |= v << (56 - r->n);
+    r->n += 8;
+  }
+}
+
+static inline uint32_t get_bits(bit_reader_t *r, int bits)
+{
+  uint32_t v;
+
+  if (bits == 0) return 0;
+  refill(r);
+  v = (uint32_t) (r->acc >> (64 - bits));
+  r->acc <<= bits;
+  r->n -= bits;
+
+  return v;
+}
+
+static inline bool get_overrun(const bit_reader_t *r)
+{
+  return (size_t) (r->p - r->start) * 8 - r->n > (size_t) (r->end - r->start) * 8;
+}
+
+static inline int get_unary(bit_reader_t *r, uint32_t *q)
+{
+  uint32_t z = 0;
+  int c;
+
+  for (;;) {
+    refill(r);
+    c = r->acc ? __builtin_clzll(r->acc) : 64;
+    if (c < r->n) {
+      r->acc <<= c;
+      r->acc <<= 1;
+      r->n -= c + 1;
+      *q = z + c;
+      return OK;
+    }
+    z += r->n;
+    r->acc = 0;
+    r->n = 0;
+    if (get_overrun(r)) return ERROR_ARG;
+  }
+}
+
+/**
+ * sums of the absolute residuals of the fixed predictors, from
+ * LOSSLESS_MAX_ORDER on so they compare
+ */
+static int best_order(const int32_t *x, uint32_t n)
+{
+  uint64_t sum[LOSSLESS_MAX_ORDER + 1] = {0};
+  int64_t e0, e1, e2, e3, e4;
+  int order = 0;
+
+  if (n <= LOSSLESS_MAX_ORDER)
+    return 0;
+
+  for (uint32_t i = LOSSLESS_MAX_ORDER; i < n; i++) {
+    e0 = x[i];
+    e1 = e0 - x[i - 1];
+    e2 = e1 - ((int64_t) x[i - 1] - x[i - 2]);
+    e3 = e2 - ((int64_t) x[i - 1] - 2 * (int64_t) x[i - 2] + x[i - 3]);
+    e4 = e3 - ((int64_t) x[i - 1] - 3 * (int64_t) x[i - 2] + 3 * (int64_t) x[i - 3] - x[i - 4]);
+    sum[0] += (uint64_t) (e0 < 0 ? -e0 : e0);
+    sum[1] += (uint64_t) (e1 < 0 ? -e1 : e1);
+    sum[2] += (uint64_t) (e2 < 0 ? -e2 : e2);
+    sum[3] += (uint64_t) (e3 < 0 ? -e3 : e3);
+    sum[4] += (uint64_t) (e4 < 0 ? -e4 : e4);
+  }
+
+  for (int i = 1; i <= LOSSLESS_MAX_ORDER; i++)
+    if (sum[i] < sum[order]) order = i;
+
+  return order;
+}
+
+/**
+ * zigzag residuals of the order predictor, x[order..n) to u[0..n-order)
+ */
+static void residual(uint32_t *u, const int32_t *x, uint32_t n, int order)
+{
+  uint32_t i;
+
+  // int32 is enough, 24 bits of samples grow by 4 bits at most
+  switch (order) {
+    case 0:
+      for (i = 0; i < n; i++)
+        u[i] = zigzag(x[i]);
+      break;
+    case 1:
+      for (i = 1; i < n; i++)
+        u[i - 1] = zigzag(x[i] - x[i - 1]);
+      break;
+    case 2:
+      for (i = 2; i < n; i++)
+        u[i - 2] = zigzag(x[i] - 2 * x[i - 1] + x[i - 2]);
+      break;
+    case 3:
+      for (i = 3; i < n; i++)
+        u[i - 3] = zigzag(x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3]);
+      break;
+    default:
+      for (i = 4; i < n; i++)
+        u[i - 4] = zigzag(x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4]);
+      break;
+  }
+}
+
+/**
+ * the cheapest rice parameter of a partition, or RICE_ESCAPE with the
+ * raw width in *width
+ *
+ * @return bits the partition takes
+ */
+static uint64_t rice_param(const uint32_t *u, uint32_t cnt, int *param, int *width)
+{
+  uint64_t sum = 0, cost[3] = {0}, best;
+  uint32_t max = 0;
+  int k = 0, k0;
+
+  for (uint32_t i = 0; i < cnt; i++) {
+    sum += u[i];
+    max |= u[i];
+  }
+  while (k < 30 && ((uint64_t) cnt << (k + 1)) < sum)
+    k++;
+  k0 = k > 0 ? k - 1 : 0;
+
+  for (uint32_t i = 0; i < cnt; i++) {
+    cost[0] += u[i] >> k0;
+    cost[1] += u[i] >> (k0 + 1);
+    cost[2] += u[i] >> (k0 + 2);
+  }
+
+  *width = max ? 32 - __builtin_clz(max) : 0;
+  *param = RICE_ESCAPE;
+  best = RICE_PARAM_BITS * 2 + (uint64_t) cnt * *width;
+  for (int i = 0; i < 3; i++) {
+    if (k0 + i >= RICE_ESCAPE) break;
+    cost[i] += RICE_PARAM_BITS + (uint64_t) cnt * (k0 + i + 1);
+    if (cost[i] < best) {
+      best = cost[i];
+      *param = k0 + i;
+    }
+  }
+
+  return best;
+}
+
+static int encode_channel(bit_writer_t *w, const uint8_t *end, int32_t *x, uint32_t n, int bits)
+{
+  uint32_t u[LOSSLESS_MAX_FRAMES];
+  int param[MAX_PARTITIONS], width[MAX_PARTITIONS];
+  uint32_t or = 0, i, cnt, parts;
+  uint64_t cost, verbatim;
+  int shift = 0, order;
+
+  for (i = 0; i < n; i++)
+    or |= (uint32_t) x[i];
+  if (or) {
+    shift = __builtin_ctz(or);
+    if (shift > 15) shift = 15;
+    if (shift >= bits) shift = bits - 1;
+  }
+  if (shift) {
+    bits -= shift;
+    for (i = 0; i < n; i++)
+      x[i] >>= shift;
+  }
+
+  order = best_order(x, n);
+  if ((uint32_t) order > n) order = 0;
+  residual(u, x, n, order);
+
+  parts = (n - order + LOSSLESS_PARTITION - 1) / LOSSLESS_PARTITION;
+  cost = 8 + (uint64_t) order * bits;
+  for (i = 0; i < parts; i++) {
+    cnt = n - order - i * LOSSLESS_PARTITION;
+    if (cnt > LOSSLESS_PARTITION) cnt = LOSSLESS_PARTITION;
+    cost += rice_param(u + i * LOSSLESS_PARTITION, cnt, &param[i], &width[i]);
+  }
+  verbatim = 8 + (uint64_t) n * bits;
+
+  if (verbatim <= cost) {
+    if ((uint64_t) (end - w->p) * 8 < verbatim) return ERROR_ARG;
+    put_bits(w, (uint32_t) shift << 4 | LOSSLESS_VERBATIM, 8);
+    for (i = 0; i < n; i++)
+      put_bits(w, (uint32_t) x[i] & (0xFFFFFFFFu >> (32 - bits)), bits);
+    put_align(w);
+    return OK;
+  }
+
+  if ((uint64_t) (end - w->p) * 8 < ((cost + 7) & ~7ull)) return ERROR_ARG;
+  put_bits(w, (uint32_t) shift << 4 | (uint32_t) order, 8);
+  for (i = 0; i < (uint32_t) order; i++)
+    put_bits(w, (uint32_t) x[i] & (0xFFFFFFFFu >> (32 - bits)), bits);
+
+  for (uint32_t p = 0; p < parts; p++) {
+    const uint32_t *pu = u + p * LOSSLESS_PARTITION;
+    cnt = n - order - p * LOSSLESS_PARTITION;
+    if (cnt > LOSSLESS_PARTITION) cnt = LOSSLESS_PARTITION;
+
+    put_bits(w, (uint32_t) param[p], RICE_PARAM_BITS);
+    if (param[p] == RICE_ESCAPE) {
+      put_bits(w, (uint32_t) width[p], RICE_PARAM_BITS);
+      if (width[p])
+        for (i = 0; i < cnt; i++)
+          put_bits(w, pu[i], width[p]);
+    } else {
+      for (i = 0; i < cnt; i++)
+        put_rice(w, pu[i], param[p]);
+    }
+  }
+  put_align(w);
+
+  return OK;
+}
+
+int lossless_encode(void *dst, size_t size, const void *src, uint16_t frames, uint8_t channels, audio_bits_t bits)
+{
+  int32_t x[LOSSLESS_MAX_FRAMES];
+  const uint8_t *in = (const uint8_t *) src, *end = (uint8_t *) dst + size;
+  bit_writer_t w = {.p = (uint8_t *) dst};
+  int bytes = lossless_sample_size(bits), ret;
+  size_t stride;
+
+  if (bytes == 0 || frames > LOSSLESS_MAX_FRAMES || channels == 0 || channels > LOSSLESS_MAX_CHANNELS)
+    return ERROR_ARG;
+  if (size < LOSSLESS_HEADER_SIZE)
+    return ERROR_ARG;
+
+  w.p[0] = (uint8_t) frames;
+  w.p[1] = (uint8_t) (frames >> 8);
+  w.p[2] = channels;
+  w.p += LOSSLESS_HEADER_SIZE;
+
+  stride = (size_t) bytes * channels;
+  for (int ch = 0; ch < channels; ch++) {
+    const uint8_t *p = in + ch * bytes;
+    for (uint32_t i = 0; i < frames; i++, p += stride)
+      x[i] = read_sample(p, bytes);
+
+    ret = encode_channel(&w, end, x, frames, bytes * 8);
+    if (ret) return ret;
+  }
+
+  return (int) (w.p - (uint8_t *) dst);
+}
+
+int lossless_info(const void *src, size_t src_size, uint16_t *frames, uint8_t *channels)
+{
+  const uint8_t *p = (const uint8_t *) src;
+
+  if (src_size < LOSSLESS_HEADER_SIZE)
+    return ERROR_ARG;
+
+  *frames = (uint16_t) (p[0] | p[1] << 8);
+  *channels = p[2];
+  if (*frames > LOSSLESS_MAX_FRAMES || *channels == 0 || *channels > LOSSLESS_MAX_CHANNELS)
+    return ERROR_ARG;
+
+  return OK;
+}
+
+static int decode_channel(bit_reader_t *r, int32_t *x, uint32_t n, int bits)
+{
+  uint32_t *u = (uint32_t *) x, i, cnt, q;
+  uint32_t byte = get_bits(r, 8);
+  int shift = (int) (byte >> 4), type = (int) (byte & 0x0F), param, width;
+
+  bits -= shift;
+  if (bits <= 0) return ERROR_ARG;
+
+  if (type == LOSSLESS_VERBATIM) {
+    for (i = 0; i < n; i++)
+      x[i] = sign_extend(get_bits(r, bits), bits);
+    goto done;
+  }
+  if (type > LOSSLESS_MAX_ORDER || (uint32_t) type > n)
+    return ERROR_ARG;
+
+  for (i = 0; i < (uint32_t) type; i++)
+    x[i] = sign_extend(get_bits(r, bits), bits);
+
+  for (uint32_t s = type; s < n; s += cnt) {
+    cnt = n - s;
+    if (cnt > LOSSLESS_PARTITION) cnt = LOSSLESS_PARTITION;
+
+    param = (int) get_bits(r, RICE_PARAM_BITS);
+    if (param == RICE_ESCAPE) {
+      width = (int) get_bits(r, RICE_PARAM_BITS);
+      for (i = s; i < s + cnt; i++)
+        x[i] = unzigzag(get_bits(r, width));
+      continue;
+    }
+    for (i = s; i < s + cnt; i++) {
+      if (get_unary(r, &q)) return ERROR_ARG;
+      x[i] = unzigzag((q << param) | get_bits(r, param));
+    }
+  }
+
+  // unsigned, a corrupted packet must not overflow
+  switch (type) {
+    case 1:
+      for (i = 1; i < n; i++)
+        u[i] += u[i - 1];
+      break;
+    case 2:
+      for (i = 2; i < n; i++)
+        u[i] += 2 * u[i - 1] - u[i - 2];
+      break;
+    case 3:
+      for (i = 3; i < n; i++)
+        u[i] += 3 * u[i - 1] - 3 * u[i - 2] + u[i - 3];
+      break;
+    case 4:
+      for (i = 4; i < n; i++)
+        u[i] += 4 * u[i - 1] - 6 * u[i - 2] + 4 * u[i - 3] - u[i - 4];
+      break;
+    default:
+      break;
+  }
+
+done:
+  if (shift)
+    for (i = 0; i < n; i++)
+      u[i] <<= shift;
+
+  // subframes are byte aligned
+  r->acc <<= r->n & 7;
+  r->n &= ~7;
+
+  return get_overrun(r) ? ERROR_ARG : OK;
+}
+
+int lossless_decode(void *dst, size_t size, const void *src, size_t src_size, audio_bits_t bits)
+{
+  int32_t x[LOSSLESS_MAX_FRAMES];
+  bit_reader_t r = {0};
+  int bytes = lossless_sample_size(bits), ret;
+  uint16_t frames;
+  uint8_t channels;
+  size_t stride;
+
+  if (bytes == 0)
+    return ERROR_ARG;
+  ret = lossless_info(src, src_size, &frames, &channels);
+  if (ret) return ret;
+
+  stride = (size_t) bytes * channels;
+  if (size < stride * frames)
+    return ERROR_ARG;
+
+  r.start = (const uint8_t *) src;
+  r.p = r.start + LOSSLESS_HEADER_SIZE;
+  r.end = r.start + src_size;
+
+  for (int ch = 0; ch < channels; ch++) {
+    ret = decode_channel(&r, x, frames, bytes * 8);
+    if (ret) return ret;
+
+    uint8_t *p = (uint8_t *) dst + ch * bytes;
+    for (uint32_t i = 0; i < frames; i++, p += stride)
+      write_sample(p, bytes, x[i]);
+  }
+
+  return (int) (stride * frames);
+}
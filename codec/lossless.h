@@ -0,0 +1,87 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef LOSSLESS_H
+#define LOSSLESS_H
+
+#include <stddef.h>
+#include <stdint-gcc.h>
+#include "../audio.h"
+
+/*
+ * Lossless codec of COMPRESS_LOSSLESS packets, FLAC style: every channel
+ * is predicted with the fixed polynomial predictor of order 0-4 that fits
+ * best, and the residuals are Rice coded in partitions of
+ * LOSSLESS_PARTITION samples, each with its own parameter. A channel that
+ * does not compress is stored verbatim, so the output is never much
+ * larger than the input.
+
++──────+──────────+──────────+─────────────────────────+
+|      | frames   | channels | channel 0 .. channels-1 |
++──────+──────────+──────────+─────────────────────────+
+| size | 16       | 8        | byte aligned subframes  |
++──────+──────────+──────────+─────────────────────────+
+
+ a subframe starts with a byte: 4 bits of wasted (always zero) low bits
+ of the samples and 4 bits of type, the predictor order or LOSSLESS_VERBATIM
+
+ */
+
+#define LOSSLESS_HEADER_SIZE  3
+// frames of one packet, bounds the stack of the encoder
+#define LOSSLESS_MAX_FRAMES   4096
+#define LOSSLESS_MAX_CHANNELS 32
+#define LOSSLESS_MAX_ORDER    4
+#define LOSSLESS_PARTITION    256
+#define LOSSLESS_VERBATIM     0x0F
+
+// bytes of dst that are always enough for lossless_encode()
+#define LOSSLESS_MAX_SIZE(frames, channels, bytes) \
+  (LOSSLESS_HEADER_SIZE + (channels) * (1 + (size_t) (frames) * (bytes)))
+
+/**
+ * bytes of one sample of bits in the packet, 0 if the codec can not do it
+ * (32 bit integer and float)
+ */
+int lossless_sample_size(audio_bits_t bits);
+
+/**
+ * Encode frames of channels interleaved little endian samples of bits
+ * (16 bit in 2 bytes, 20 and 24 bit in 3 bytes).
+ *
+ * @return bytes written to dst, or ERROR_ARG
+ */
+int lossless_encode(void *dst, size_t size, const void *src, uint16_t frames, uint8_t channels, audio_bits_t bits);
+
+/**
+ * read frames and channels of an encoded packet, to size the output
+ *
+ * @return OK, or ERROR_ARG
+ */
+int lossless_info(const void *src, size_t src_size, uint16_t *frames, uint8_t *channels);
+
+/**
+ * Decode a lossless_encode() packet back into interleaved samples of bits.
+ *
+ * @return bytes written to dst, or ERROR_ARG if dst is too small or src
+ *         is corrupted
+ */
+int lossless_decode(void *dst, size_t size, const void *src, size_t src_size, audio_bits_t bits);
+
+#endif //LOSSLESS_H
@@ -23,11 +23,9 @@
 #include <stdint.h>
 #include "log.h"
 #include "utils.h"
+#include "wakeup.h"
 
 
-#define SOCKET_QUIT_MAGIC       "quit"
-#define SOCKET_QUIT_MAGIC_SIZE  4
-
 #if WIN32
 typedef int64_t socket_t;
 #define SOCKET_INIT()             do { \
@@ -39,15 +37,6 @@ return 1;                              \
 }} while(0)
 #define SOCKET_DEINIT()           WSACleanup()
 
-#define DECL_THREAD_CMD()         static int wakeup_fd = 0;
-#define INIT_THREAD_CMD(name)     if ((wakeup_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) { LOGF( name" socket: %m"); exit(1); }
-#define WRITE_EXIT_THREAD_CMD()   if (wakeup_fd) write(wakeup_fd, SOCKET_QUIT_MAGIC, SOCKET_QUIT_MAGIC_SIZE)
-#define DEINIT_THREAD_CMD()       do{close(wakeup_fd); wakeup_fd=0;}while(0)
-#define ADD_THREAD_CMD(fds)       FD_SET(wakeup_fd, fds)
-#define CHK_CMD_EXIT_THREAD(fds)  do { \
-CHK_EXIT_THREAD(); \
-if (FD_ISSET(wakeup_fd, fds))  \
-return ERROR_EXIT;}while(0)
 #elif ESP_PLATFORM
 
 #define sexit(n)                  return (n);
@@ -56,15 +45,6 @@ return ERROR_EXIT;}while(0)
 typedef int32_t socket_t;
 #define SOCKET_INIT()             do {}while(0)
 #define SOCKET_DEINIT()           ;
-#define DECL_THREAD_CMD()         static int wakeup_fd[2] = {0}; static char _buf[SOCKET_QUIT_MAGIC_SIZE] = {0};
-#define INIT_THREAD_CMD(name)     if (pipe(wakeup_fd) < 0) { LOGF( name" pipe: %m"); exit(1); }
-#define WRITE_EXIT_THREAD_CMD()   if (wakeup_fd[0]) write(wakeup_fd[1], SOCKET_QUIT_MAGIC, SOCKET_QUIT_MAGIC_SIZE)
-#define DEINIT_THREAD_CMD()       do{close(wakeup_fd[0]); close(wakeup_fd[1]); wakeup_fd[0]=0; wakeup_fd[1]=0;}while(0)
-#define ADD_THREAD_CMD(fds)       FD_SET(wakeup_fd[0], fds)
-#define CHK_CMD_EXIT_THREAD(fds)  do {\
-CHK_EXIT_THREAD(); \
-if (FD_ISSET(wakeup_fd[0], fds))  \
-return ERROR_EXIT; }while(0)
 
 #define max(a,b) \
    ({ __typeof__ (a) _a = (a); \
@@ -75,9 +55,28 @@ return ERROR_EXIT; }while(0)
 #endif
 
 #define CHK_EXIT_THREAD()           if (exit_thread_flag) return -1
-#define CHK_RECV_EXIT_THREAD(buf)    if (exit_thread_flag || (n == SOCKET_QUIT_MAGIC_SIZE && \
-memcmp((buf), SOCKET_QUIT_MAGIC, SOCKET_QUIT_MAGIC_SIZE) == 0)) \
-goto exit_thread
+// nothing but data arrives on a socket, the buffer is not looked at
+#define CHK_RECV_EXIT_THREAD(buf)    if (exit_thread_flag) goto exit_thread
+
+/*
+ * The wakeup of a thread only says "look again": why is in thread_cmd_exit
+ * or in whatever work the waker queued. The same on every platform, WIN32
+ * included: wakeup.c picks eventfd, a loopback socket or a pipe.
+ */
+#define DECL_THREAD_CMD()         static wakeup_t thread_cmd = WAKEUP_INITIALIZER; static volatile int thread_cmd_exit = 0
+#define INIT_THREAD_CMD(name)     do { thread_cmd_exit = 0; \
+if (OK != wakeup_init(&thread_cmd)) { LOGF( name" wakeup: %m"); exit(1); }} while(0)
+#define WAKEUP_THREAD_CMD()       wakeup_signal(&thread_cmd)
+#define WRITE_EXIT_THREAD_CMD()   do { thread_cmd_exit = 1; wakeup_signal(&thread_cmd); } while(0)
+#define DEINIT_THREAD_CMD()       wakeup_deinit(&thread_cmd)
+#define THREAD_CMD_FD()           wakeup_fd(&thread_cmd)
+#define ADD_THREAD_CMD(fds)       FD_SET(THREAD_CMD_FD(), fds)
+// the wakeup fd polled readable: consume it, leave if asked to
+#define DRAIN_THREAD_CMD()        do { wakeup_drain(&thread_cmd); \
+if (thread_cmd_exit) return ERROR_EXIT; } while(0)
+#define CHK_CMD_EXIT_THREAD(fds)  do { \
+CHK_EXIT_THREAD(); \
+if (FD_ISSET(THREAD_CMD_FD(), fds)) DRAIN_THREAD_CMD(); } while(0)
 
 
 #define BIT_4TO8(a, b)      ( (((a) & 0x0F) << 4) | (((b) & 0x0F) << 0) )
@@ -46,7 +46,7 @@ typedef int (*write_fn)();
 
 typedef void (*recv_refuse)();
 
-#define DEFAULT_CONNECTION_UDP_INIT {0, 0, 0, 0, 1, NULL, NULL};
+#define DEFAULT_CONNECTION_UDP_INIT {0, 0, 0, 0, NULL, NULL};
 
 
 struct connection_s {
@@ -54,9 +54,9 @@ struct connection_s {
     uint32_t index;
     sa_family_t family;
     uint8_t tcp;
-    uint8_t readed;
     read_fn read_cb;
     recv_refuse refuse_cb;
+    uint8_t drain;  // read until EAGAIN on every dispatch (edge-triggered)
 };
 
 #endif //CONNECTION_H
@@ -17,26 +17,351 @@
 */
 
 
+#include <pthread.h>
 #include "crc.h"
+#include "error.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRC_X86
+#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__linux__)
+#define CRC_ARM
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
 
-uint8_t crc8_check(const uint8_t *buffer, uint32_t length)
-{
-  uint32_t i;
-  uint8_t crc = CRC_INIT;
+typedef uint32_t (*crc32_fn)(uint32_t crc, const uint8_t *p, size_t len);
+
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
 
-  while (length--) {
-    crc ^= *buffer++;
+static uint8_t crc8_table[256];
+static uint32_t crc32_table[8][256];
+static uint32_t crc32c_table[8][256];
+
+static crc32_fn simd32 = NULL, simd32c = NULL;
+static crc32_fn crc32_impl = NULL, crc32c_impl = NULL;
+static const char *simd32_name = "table", *simd32c_name = "table";
+
+static void make_table(uint32_t table[8][256], uint32_t poly)
+{
+  uint32_t i, j, c;
 
-    for (i = 0; i < 8; i++) {
-      if (crc & 0x80) {
-        crc <<= 1;
-        crc ^= CRC_POLY;
-      } else {
-        crc <<= 1;
-      }
+  for (i = 0; i < 256; i++) {
+    c = i;
+    for (j = 0; j < 8; j++)
+      c = (c >> 1) ^ (c & 1 ? poly : 0);
+    table[0][i] = c;
+  }
+  // table[k][i] is the crc of byte i followed by k zero bytes
+  for (i = 0; i < 256; i++) {
+    c = table[0][i];
+    for (j = 1; j < 8; j++) {
+      c = table[0][c & 0xff] ^ (c >> 8);
+      table[j][i] = c;
     }
   }
+}
+
+/**
+ * slicing-by-8, crc is the inverted (running) value
+ */
+static uint32_t crc_slice8(uint32_t table[8][256], uint32_t crc, const uint8_t *p, size_t len)
+{
+  uint32_t lo, hi;
+
+  while (len && ((uintptr_t) p & 7)) {
+    crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    len--;
+  }
+  while (len >= 8) {
+    // the tables are for the reflected crc, the first byte is the lowest
+    lo = crc ^ ((uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24);
+    hi = (uint32_t) p[4] | (uint32_t) p[5] << 8 | (uint32_t) p[6] << 16 | (uint32_t) p[7] << 24;
+    crc = table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff] ^
+          table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24] ^
+          table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff] ^
+          table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24];
+    p += 8;
+    len -= 8;
+  }
+  while (len--)
+    crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+  return crc;
+}
+
+static uint32_t crc32_table_update(uint32_t crc, const uint8_t *p, size_t len)
+{
+  return crc_slice8(crc32_table, crc, p, len);
+}
+
+static uint32_t crc32c_table_update(uint32_t crc, const uint8_t *p, size_t len)
+{
+  return crc_slice8(crc32c_table, crc, p, len);
+}
+
+#ifdef CRC_X86
+/**
+ * Fold 64 bytes at a time with carry-less multiplication, then reduce
+ * to 32 bits with Barrett reduction, as in Intel's "Fast CRC Computation
+ * for Generic Polynomials Using PCLMULQDQ Instruction". The constants are
+ * x^(4*128+32), x^(4*128-32), x^(128+32), x^(128-32) and x^64 mod P(x),
+ * bit reflected, and the Barrett constants of P(x).
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_pclmul(uint32_t crc, const uint8_t *p, size_t len)
+{
+  static const uint64_t k1k2[2] __attribute__((aligned(16))) = {0x0154442bd4, 0x01c6e41596};
+  static const uint64_t k3k4[2] __attribute__((aligned(16))) = {0x01751997d0, 0x00ccaa009e};
+  static const uint64_t k5k0[2] __attribute__((aligned(16))) = {0x0163cd6124, 0x0000000000};
+  static const uint64_t poly[2] __attribute__((aligned(16))) = {0x01db710641, 0x01f7011641};
+  __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, mask;
+
+  if (len < 64)
+    return crc32_table_update(crc, p, len);
+
+  x1 = _mm_loadu_si128((const __m128i *) (p + 0x00));
+  x2 = _mm_loadu_si128((const __m128i *) (p + 0x10));
+  x3 = _mm_loadu_si128((const __m128i *) (p + 0x20));
+  x4 = _mm_loadu_si128((const __m128i *) (p + 0x30));
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int) crc));
+  x0 = _mm_load_si128((const __m128i *) k1k2);
+  p += 64;
+  len -= 64;
+
+  while (len >= 64) {
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+    x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *) (p + 0x00)));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *) (p + 0x10)));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *) (p + 0x20)));
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *) (p + 0x30)));
+    p += 64;
+    len -= 64;
+  }
+
+  // fold the 4 lanes into one
+  x0 = _mm_load_si128((const __m128i *) k3k4);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+  while (len >= 16) {
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i *) p)), x5);
+    p += 16;
+    len -= 16;
+  }
+
+  // 128 to 64 bits
+  mask = _mm_setr_epi32(~0, 0, ~0, 0);
+  x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+  x0 = _mm_loadl_epi64((const __m128i *) k5k0);
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  // Barrett reduction to 32 bits
+  x0 = _mm_load_si128((const __m128i *) poly);
+  x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), x0, 0x10);
+  x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask), x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+  crc = (uint32_t) _mm_extract_epi32(x1, 1);
+
+  return crc32_table_update(crc, p, len);
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *p, size_t len)
+{
+  while (len && ((uintptr_t) p & 7)) {
+    crc = _mm_crc32_u8(crc, *p++);
+    len--;
+  }
+#ifdef __x86_64__
+  uint64_t c = crc;
+  for (; len >= 8; p += 8, len -= 8)
+    c = _mm_crc32_u64(c, *(const uint64_t *) p);
+  crc = (uint32_t) c;
+#endif
+  for (; len >= 4; p += 4, len -= 4)
+    crc = _mm_crc32_u32(crc, *(const uint32_t *) p);
+  while (len--)
+    crc = _mm_crc32_u8(crc, *p++);
+
+  return crc;
+}
+#endif
+
+#ifdef CRC_ARM
+/**
+ * the ARMv8 CRC extension has both polynomials, folding with PMULL does
+ * not pay off on top of it
+ */
+__attribute__((target("+crc")))
+static uint32_t crc32_armv8(uint32_t crc, const uint8_t *p, size_t len)
+{
+  while (len && ((uintptr_t) p & 7)) {
+    crc = __crc32b(crc, *p++);
+    len--;
+  }
+  for (; len >= 8; p += 8, len -= 8)
+    crc = __crc32d(crc, *(const uint64_t *) p);
+  while (len--)
+    crc = __crc32b(crc, *p++);
+
+  return crc;
+}
+
+__attribute__((target("+crc")))
+static uint32_t crc32c_armv8(uint32_t crc, const uint8_t *p, size_t len)
+{
+  while (len && ((uintptr_t) p & 7)) {
+    crc = __crc32cb(crc, *p++);
+    len--;
+  }
+  for (; len >= 8; p += 8, len -= 8)
+    crc = __crc32cd(crc, *(const uint64_t *) p);
+  while (len--)
+    crc = __crc32cb(crc, *p++);
+
+  return crc;
+}
+#endif
+
+static void crc_init()
+{
+  uint32_t i, j;
+  uint8_t c;
+
+  for (i = 0; i < 256; i++) {
+    c = (uint8_t) i;
+    for (j = 0; j < 8; j++)
+      c = (uint8_t) (c & 0x80 ? (c << 1) ^ CRC_POLY : c << 1);
+    crc8_table[i] = c;
+  }
+  make_table(crc32_table, CRC32_POLY);
+  make_table(crc32c_table, CRC32C_POLY);
+
+#if defined(CRC_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+    simd32 = crc32_pclmul;
+    simd32_name = "pclmul";
+  }
+  if (__builtin_cpu_supports("sse4.2")) {
+    simd32c = crc32c_sse42;
+    simd32c_name = "sse4.2";
+  }
+#elif defined(CRC_ARM)
+  if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+    simd32 = crc32_armv8;
+    simd32c = crc32c_armv8;
+    simd32_name = simd32c_name = "armv8";
+  }
+#endif
+
+  crc32_impl = simd32 ? simd32 : crc32_table_update;
+  crc32c_impl = simd32c ? simd32c : crc32c_table_update;
+}
+
+int crc_set_impl(crc_impl_t impl)
+{
+  pthread_once(&crc_once, crc_init);
+
+  switch (impl) {
+    case CRC_IMPL_AUTO:
+      crc32_impl = simd32 ? simd32 : crc32_table_update;
+      crc32c_impl = simd32c ? simd32c : crc32c_table_update;
+      return OK;
+    case CRC_IMPL_TABLE:
+      crc32_impl = crc32_table_update;
+      crc32c_impl = crc32c_table_update;
+      return OK;
+    case CRC_IMPL_SIMD:
+      if (!simd32 || !simd32c) return ERROR_ARG;
+      crc32_impl = simd32;
+      crc32c_impl = simd32c;
+      return OK;
+    default:
+      return ERROR_ARG;
+  }
+}
+
+const char *crc32_impl_name()
+{
+  pthread_once(&crc_once, crc_init);
+  return crc32_impl == crc32_table_update ? "table" : simd32_name;
+}
+
+const char *crc32c_impl_name()
+{
+  pthread_once(&crc_once, crc_init);
+  return crc32c_impl == crc32c_table_update ? "table" : simd32c_name;
+}
+
+uint8_t crc8_update(uint8_t crc, const void *buffer, size_t length)
+{
+  const uint8_t *p = buffer;
+
+  pthread_once(&crc_once, crc_init);
+
+  while (length--)
+    crc = crc8_table[crc ^ *p++];
 
   return crc;
-}
\ No newline at end of file
+}
+
+uint8_t crc8_check(const uint8_t *buffer, uint32_t length)
+{
+  return crc8_update(CRC_INIT, buffer, length) ^ CRC_XOROUT;
+}
+
+uint32_t crc32_update(uint32_t crc, const void *buffer, size_t length)
+{
+  pthread_once(&crc_once, crc_init);
+  return ~crc32_impl(~crc, buffer, length);
+}
+
+uint32_t crc32c_update(uint32_t crc, const void *buffer, size_t length)
+{
+  pthread_once(&crc_once, crc_init);
+  return ~crc32c_impl(~crc, buffer, length);
+}
+
+uint32_t crc32_update_iov(uint32_t crc, const struct iovec *iov, int iovcnt)
+{
+  pthread_once(&crc_once, crc_init);
+
+  crc = ~crc;
+  for (int i = 0; i < iovcnt; i++)
+    crc = crc32_impl(crc, iov[i].iov_base, iov[i].iov_len);
+
+  return ~crc;
+}
+
+uint32_t crc32c_update_iov(uint32_t crc, const struct iovec *iov, int iovcnt)
+{
+  pthread_once(&crc_once, crc_init);
+
+  crc = ~crc;
+  for (int i = 0; i < iovcnt; i++)
+    crc = crc32c_impl(crc, iov[i].iov_base, iov[i].iov_len);
+
+  return ~crc;
+}
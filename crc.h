@@ -21,13 +21,69 @@
 #define SCREAM_CRC_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint-gcc.h>
+#if !WIN32
+#include <sys/uio.h>
+#endif
 
 
 #define CRC_POLY    0x07
 #define CRC_INIT    0x00
 #define CRC_XOROUT  0x00
 
+// reflected polynomials of CRC-32 (IEEE 802.3) and CRC-32C (Castagnoli)
+#define CRC32_POLY  0xedb88320
+#define CRC32C_POLY 0x82f63b78
+
+typedef enum crc_impl_e {
+    // the fastest one the CPU supports
+    CRC_IMPL_AUTO,
+    // slicing-by-8 tables, everywhere
+    CRC_IMPL_TABLE,
+    // PCLMULQDQ folding and SSE4.2 crc32, or the ARMv8 crc32 instructions
+    CRC_IMPL_SIMD,
+} crc_impl_t;
+
+/**
+ * Select the implementation used by the crc32 functions, for benchmarks
+ * and tests. The CPU is probed on the first call of any of them.
+ *
+ * @return OK, or ERROR_ARG if the CPU does not support impl
+ */
+int crc_set_impl(crc_impl_t impl);
+
+/**
+ * @return name of the crc32 and crc32c implementations in use
+ */
+const char *crc32_impl_name();
+const char *crc32c_impl_name();
+
 uint8_t crc8_check(const uint8_t *buffer, uint32_t length);
 
+/**
+ * continue crc8_check() of the data before buffer, crc8_check() is
+ * crc8_update(CRC_INIT, ...)
+ */
+uint8_t crc8_update(uint8_t crc, const void *buffer, size_t length);
+
+/**
+ * CRC-32 of buffer appended to the data crc was computed over, starting
+ * with 0, e.g. crc32_update(crc32_update(0, a, n), b, m) is the crc of a
+ * and b concatenated. The result is the usual one (zlib, ethernet).
+ */
+uint32_t crc32_update(uint32_t crc, const void *buffer, size_t length);
+
+/**
+ * crc32_update() with the Castagnoli polynomial (iSCSI, ext4)
+ */
+uint32_t crc32c_update(uint32_t crc, const void *buffer, size_t length);
+
+/**
+ * crc32_update() and crc32c_update() over iovcnt pieces, e.g. a
+ * pcm_packet_t header and its samples from pcm_packet_iov()
+ */
+uint32_t crc32_update_iov(uint32_t crc, const struct iovec *iov, int iovcnt);
+uint32_t crc32c_update_iov(uint32_t crc, const struct iovec *iov, int iovcnt);
+
 #endif //SCREAM_CRC_H
@@ -33,6 +33,7 @@
 #define ERROR_SPEAKER         (-2)
 #define ERROR_ARG             (-3)
 #define ERROR_THREAD          (-4)
+#define ERROR_CRC             (-5)
 
 
 #endif
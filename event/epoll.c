@@ -17,4 +17,223 @@
 */
 
 
+#ifdef __linux__
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include "../log.h"
+#include "../block_queue.h"
+#include "../common.h"
+#include "../error.h"
+#include "../timer.h"
 #include "epoll.h"
+
+
+static int epfd = -1;
+static int edge_triggered = 0;
+
+static queue_t *queue = NULL;
+DECL_THREAD_CMD();
+// registered for the timerfd instead of a connection
+static char timer_tag;
+
+LOG_TAG_DECLR("event");
+
+static int epoll_ctl_connection(int op, connection_t *c)
+{
+  struct epoll_event ev = {0};
+
+  // one report per arming, the protocol re-arms after reading
+  ev.events = EPOLLIN | EPOLLONESHOT;
+  if (edge_triggered) ev.events |= EPOLLET;
+  ev.data.ptr = c;
+
+  return epoll_ctl(epfd, op, c->read_fd, &ev);
+}
+
+int epoll_add_connection(connection_t *c)
+{
+  c->drain = edge_triggered;
+
+  if (0 > epoll_ctl_connection(EPOLL_CTL_ADD, c)) {
+    LOGE("epoll add %d error: %m", c->read_fd);
+    return ERROR_SOCKET;
+  }
+
+  return OK;
+}
+
+int epoll_rearm_connection(connection_t *c)
+{
+  // MOD re-evaluates readiness, data that arrived meanwhile is reported again
+  if (0 > epoll_ctl_connection(EPOLL_CTL_MOD, c) && errno != ENOENT && errno != EBADF) {
+    LOGE("epoll rearm %d error: %m", c->read_fd);
+    return ERROR_SOCKET;
+  }
+
+  return OK;
+}
+
+int epoll_del_connection(const connection_t *c)
+{
+  if (0 > epoll_ctl(epfd, EPOLL_CTL_DEL, c->read_fd, NULL) && errno != ENOENT && errno != EBADF) {
+    LOGE("epoll del %d error: %m", c->read_fd);
+    return ERROR_SOCKET;
+  }
+
+  return OK;
+}
+
+int epoll_stop_process()
+{
+  WRITE_EXIT_THREAD_CMD();
+
+  return OK;
+}
+
+int epoll_process()
+{
+  int ready, n = 0;
+  uint32_t count;
+  connection_t *c, *conns[EPOLL_MAX_EVENTS];
+  struct epoll_event events[EPOLL_MAX_EVENTS];
+
+  ready = epoll_wait(epfd, events, EPOLL_MAX_EVENTS, 3000);
+
+  if (ready < 0) {
+    if (errno == EINTR) return OK;
+    LOGE("epoll error: %m");
+    return -1;
+  }
+
+  if (ready == 0) {
+    LOGT("epoll timeout");
+    return -2;
+  }
+
+  for (int i = 0; i < ready; ++i) {
+    c = events[i].data.ptr;
+    CHK_EXIT_THREAD();
+    // the wakeup is registered without a connection
+    if (NULL == c) {
+      DRAIN_THREAD_CMD();
+      continue;
+    }
+    if ((void *) c == &timer_tag) {
+      timer_process();
+      continue;
+    }
+
+    conns[n++] = c;
+  }
+
+  // hand the ready connections over with as few wakeups as possible
+  for (int i = 0; i < n; i += (int) count) {
+    count = n - i;
+    if (QUEUE_OK != queue_push_n(queue, conns + i, &count, NULL)) break;
+  }
+
+  return OK;
+}
+
+const queue_t *epoll_get_queue()
+{
+  return queue;
+}
+
+queue_t *epoll_init()
+{
+  struct epoll_event ev = {0};
+
+  if (queue != NULL) return queue;
+
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (0 > epfd) {
+    LOGE("epoll create error: %m");
+    return NULL;
+  }
+
+  INIT_THREAD_CMD("epoll");
+
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  if (0 > epoll_ctl(epfd, EPOLL_CTL_ADD, THREAD_CMD_FD(), &ev)) {
+    LOGE("epoll add wakeup error: %m");
+    epoll_deinit();
+    return NULL;
+  }
+
+  ev.data.ptr = &timer_tag;
+  if (timer_fd() >= 0 && 0 > epoll_ctl(epfd, EPOLL_CTL_ADD, timer_fd(), &ev)) {
+    LOGE("epoll add timer error: %m");
+    epoll_deinit();
+    return NULL;
+  }
+
+  queue = queue_create("epoll main", sizeof(connection_t *), EPOLL_QUEUE_SIZE, QUEUE_BLOCK);
+  if (NULL == queue) {
+    epoll_deinit();
+    return NULL;
+  }
+
+  return queue;
+}
+
+queue_t *epoll_et_init()
+{
+  edge_triggered = 1;
+
+  return epoll_init();
+}
+
+int epoll_deinit()
+{
+  LOGT("epoll deinit");
+
+  if (queue) {
+    queue_destory(queue);
+    queue = NULL;
+  }
+
+  DEINIT_THREAD_CMD();
+
+  if (0 <= epfd) {
+    close(epfd);
+    epfd = -1;
+  }
+  edge_triggered = 0;
+
+  return OK;
+}
+
+
+event_t event_epoll_ = {
+  epoll_init,
+  epoll_deinit,
+
+  epoll_add_connection,
+  epoll_del_connection,
+  epoll_rearm_connection,
+
+  epoll_get_queue,
+
+  epoll_process,
+  epoll_stop_process,
+};
+
+event_t event_epoll_et_ = {
+  epoll_et_init,
+  epoll_deinit,
+
+  epoll_add_connection,
+  epoll_del_connection,
+  epoll_rearm_connection,
+
+  epoll_get_queue,
+
+  epoll_process,
+  epoll_stop_process,
+};
+
+#endif
@@ -20,4 +20,41 @@
 #ifndef EPOLL_H
 #define EPOLL_H
 
+#include <stdint-gcc.h>
+#include "../connection.h"
+#include "../block_queue.h"
+#include "event.h"
+
+
+#define EPOLL_QUEUE_SIZE  100
+#define EPOLL_MAX_EVENTS  64
+
+queue_t *epoll_init();
+
+queue_t *epoll_et_init();
+
+int epoll_deinit();
+
+int epoll_add_connection(connection_t *c);
+
+int epoll_del_connection(const connection_t *c);
+
+int epoll_rearm_connection(connection_t *c);
+
+int epoll_process();
+
+int epoll_stop_process();
+
+const queue_t *epoll_get_queue();
+
+/**
+ * level-triggered
+ */
+extern event_t event_epoll_;
+
+/**
+ * edge-triggered, the protocol drains every dispatched connection until EAGAIN
+ */
+extern event_t event_epoll_et_;
+
 #endif //EPOLL_H
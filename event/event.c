@@ -20,9 +20,13 @@
 #include "event.h"
 #include "../error.h"
 #include "select.h"
+#include "epoll.h"
 #include "udp.h"
+#include "uring.h"
 #include "receive.h"
 #include "../log.h"
+#include "../thread.h"
+#include "../timer.h"
 
 event_t *event_ = NULL;
 protocol_t *protocol_ = NULL;
@@ -34,6 +38,14 @@ int event_init(enum event_type_e type, enum event_protocol_e protocol, uint32_t
     case EVENT_TYPE_SELECT:
       event_ = &event_select_;
       break;
+#ifdef __linux__
+    case EVENT_TYPE_EPOLL:
+      event_ = &event_epoll_;
+      break;
+    case EVENT_TYPE_EPOLL_ET:
+      event_ = &event_epoll_et_;
+      break;
+#endif
     default:
       return ERROR_ARG;
   }
@@ -42,25 +54,51 @@ int event_init(enum event_type_e type, enum event_protocol_e protocol, uint32_t
     case EVENT_PROTOCOL_UDP:
       protocol_ = &protocol_udp_;
       break;
+#ifdef __linux__
+    case EVENT_PROTOCOL_URING:
+      protocol_ = &protocol_uring_;
+      break;
+#endif
     default:
       return ERROR_ARG;
   }
 
-  int ret = receive_init(protocol_->init(event_->init(), buf_size, qlen));
+  // the backend polls the timerfd, timers run on the event thread
+  if (OK != timer_init(TIMER_TICK_MS)) return ERROR_ARG;
+
+  int ret = receive_init(protocol_->init(event_->init(), buf_size, qlen), protocol_->release);
+  const queue_t *q;
+
+  // one callback thread per queue keeps the order within each of them
+  for (uint32_t i = 1; OK == ret && protocol_->get_queue && (q = protocol_->get_queue(i)); ++i) {
+    ret = receive_init(q, protocol_->release);
+  }
+  if (OK != ret) timer_deinit();
 
   return ret;
 }
 
 int event_deinit() {
+  // producers first, the receive threads then drain the closed queues and leave
+  if (protocol_->stop) protocol_->stop();
   receive_deinit();
   protocol_->deinit();
   event_->deinit();
+  timer_deinit();
 
   return OK;
 }
 
 int event_start() {
+  static __thread int applied = 0;
   int ret = 0;
+
+  // the caller loops on it, its thread is the event thread
+  if (!applied) {
+    thread_apply(THREAD_ROLE_EVENT);
+    applied = 1;
+  }
+
   if (event_) ret = event_->start_process();
 
   if (ret < 0) {
@@ -80,14 +118,27 @@ int event_add(connection_t *c) {
     LOGE("connection error");
     return ERROR_ARG;
   }
-  if (event_) return event_->add_connection(c);
+  if (protocol_ && protocol_->add_connection) return protocol_->add_connection(c);
+  if (event_) {
+    int ret = event_->add_connection(c);
+
+    if (OK == ret && protocol_ && protocol_->attach_connection) ret = protocol_->attach_connection(c);
+    return ret;
+  }
 
   return OK;
 }
 
 int event_del(const connection_t *c) {
+  if (protocol_ && protocol_->del_connection) return protocol_->del_connection(c);
+  if (protocol_ && protocol_->detach_connection) protocol_->detach_connection(c);
   if (event_) return event_->del_connection(c);
 
   return OK;
 }
 
+int event_rearm(connection_t *c) {
+  if (event_ && event_->rearm_connection) return event_->rearm_connection(c);
+
+  return OK;
+}
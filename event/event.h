@@ -22,19 +22,25 @@
 #include <stdint-gcc.h>
 #include "../connection.h"
 #include "../block_queue.h"
+#include "protocol.h"
 
 enum event_type_e {
-    EVENT_TYPE_SELECT
+    EVENT_TYPE_SELECT,
+    EVENT_TYPE_EPOLL,
+    EVENT_TYPE_EPOLL_ET,
 };
 
 enum event_protocol_e {
-    EVENT_PROTOCOL_UDP
+    EVENT_PROTOCOL_UDP,
+    EVENT_PROTOCOL_URING,
 };
 
 typedef int (*event_add_connection_fn)(connection_t *c);
 
 typedef int (*event_del_connection_fn)(const connection_t *c);
 
+typedef int (*event_rearm_connection_fn)(connection_t *c);
+
 typedef int (*event_start_process_fn)();
 
 typedef int (*event_stop_process_fn)();
@@ -51,6 +57,11 @@ typedef struct event_s {
 
     event_add_connection_fn add_connection;
     event_del_connection_fn del_connection;
+    /*
+     * a dispatched connection belongs to the protocol thread until it is
+     * re-armed, the backend never reports it twice in the meantime
+     */
+    event_rearm_connection_fn rearm_connection;
 
     event_get_queue_fn get_queue;
 
@@ -61,14 +72,37 @@ typedef struct event_s {
 typedef struct protocol_s {
     queue_t *(*init)(const queue_t *event_queue, uint32_t buf_size, uint32_t qlen);
 
+    /* join the threads feeding the receive queues and close them, deinit() frees them */
+    int (*stop)();
+
     int (*deinit)();
 
+    /* optional and set by none, senders use event/send.h on their own socket */
     int (*send_data)(const void *data, size_t size);
+
+    /* optional, protocols waiting on sockets by themselves take connections from event_add() */
+    event_add_connection_fn add_connection;
+    event_del_connection_fn del_connection;
+
+    /* optional, called by the receive thread once read_cb is done with a slot */
+    void (*release)(recv_data_t *d);
+
+    /* optional, told about connections the event backend took or dropped */
+    event_add_connection_fn attach_connection;
+    event_del_connection_fn detach_connection;
+
+    /* optional, receive queues besides the one from init(), NULL past the last */
+    const queue_t *(*get_queue)(uint32_t shard);
 } protocol_t;
 
 
 int event_init(enum event_type_e type, enum event_protocol_e protocol, uint32_t buf_size, uint32_t qlen);
 
+/**
+ * Stop the protocol threads, let the receive threads drain what is queued
+ * (see receive_set_drain()) and join every thread before freeing. Stop the
+ * thread calling event_start() first.
+ */
 int event_deinit();
 
 int event_start();
@@ -79,4 +113,6 @@ int event_add(connection_t *c);
 
 int event_del(const connection_t *c);
 
+int event_rearm(connection_t *c);
+
 #endif //EVENT_H
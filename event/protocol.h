@@ -20,7 +20,9 @@
 #ifndef PROTOCOL_H
 #define PROTOCOL_H
 
+#include <time.h>
 #include "../connection.h"
+#include "timestamp.h"
 
 
 typedef struct recv_data_s {
@@ -28,9 +30,16 @@ typedef struct recv_data_s {
     struct sockaddr_storage src;
     socklen_t src_len;
     uint32_t len;
+    // kernel receive time, zero unless timestamp_enable() was called on the socket
+    struct timespec stamp;
+    // which clock stamp is from, NIC and stack stamps must not be mixed
+    timestamp_clock_t stamp_clock;
 } recv_data_t;
 
 #define RECVDATA_SIZE sizeof(recv_data_t)
 
+// the slot of a payload handed to read_cb, e.g. RECVDATA_OF(data)->stamp
+#define RECVDATA_OF(data) ((const recv_data_t *) ((const uint8_t *) (data) - RECVDATA_SIZE))
+
 
 #endif //PROTOCOL_H
@@ -18,46 +18,178 @@
 
 
 #include <stddef.h>
+#include <time.h>
 #include <pthread.h>
 #include "../log.h"
 #include "../common.h"
 #include "../error.h"
+#include "../thread.h"
 #include "receive.h"
 
 
-static pthread_t cb_thread;
+static struct receiver_s {
+    pthread_t thread;
+    const queue_t *queue;
+    receive_release_fn release;
+    // ticket of the last fence the thread got to
+    uint32_t fence;
+} receivers[RECEIVE_MAX];
 
-static const queue_t *block_queue;
+static uint32_t receiver_cnt = 0;
+// rounds to busy wait for data before sleeping on the queue
+static uint32_t receive_spin = 0;
+// what is left in a closed queue
+static receive_drain_t receive_drain = RECEIVE_DRAIN_FLUSH;
+
+// the connection of every fence slot, never read from
+static connection_t fence_conn;
+static uint32_t fence_ticket = 0;
+static pthread_mutex_t fence_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fence_cond;
+static pthread_once_t fence_once = PTHREAD_ONCE_INIT;
 
 LOG_TAG_DECLR("event");
 
+static void fence_init()
+{
+  pthread_condattr_t attr;
+
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&fence_cond, &attr);
+  pthread_condattr_destroy(&attr);
+}
+
+static void fence_pass(struct receiver_s *rv, uint32_t ticket)
+{
+  pthread_mutex_lock(&fence_lock);
+  // fences may be pushed again, the newest is what counts
+  if ((int32_t) (ticket - rv->fence) > 0) rv->fence = ticket;
+  pthread_cond_broadcast(&fence_cond);
+  pthread_mutex_unlock(&fence_lock);
+}
+
 static void *thread_cost(void *arg)
 {
+  struct receiver_s *rv = (struct receiver_s *) arg;
+  const queue_t *block_queue = rv->queue;
+  receive_release_fn release_cb = rv->release;
   recv_data_t *d;
+  void *slot;
+  uint32_t count;
   queue_ret_t ret;
-  uint32_t len;
 
-  while (!exit_thread_flag) {
-    ret = queue_pop((queue_t *) block_queue, (void **) &d, &len, NULL);
-    if (QUEUE_OK == ret && d->conn->read_cb) {
-      d->conn->read_cb(d->conn, &d->src, d->src_len, (uint8_t *) d + RECVDATA_SIZE, d->len);
-    } else {
+  // the protocol closes the queue once it stopped, leave when it is empty
+  for (;;) {
+    // read in place, the slots are only handed back once read_cb returns
+    count = 0;
+    if (receive_spin) queue_spin_not_empty(block_queue, receive_spin);
+    ret = queue_peek((queue_t *) block_queue, &slot, &count, NULL);
+    if (QUEUE_CLOSED == ret) break;
+    if (QUEUE_OK != ret) {
       LOGE("pop receive queue %d", ret);
+      continue;
+    }
+
+    for (uint32_t i = 0; i < count; ++i, slot += block_queue->size) {
+      d = (block_queue->flag & QUEUE_PTR_DATA) ? *(recv_data_t **) slot : (recv_data_t *) slot;
+      // not a datagram, and not the protocol's to take back
+      if (&fence_conn == d->conn) {
+        fence_pass(rv, d->len);
+        continue;
+      }
+      // a long batch may still be running when the queue is closed
+      if (d->conn->read_cb && !(receive_drain == RECEIVE_DRAIN_DISCARD
+                                && QUEUE_CLOSED == queue_is_closed(block_queue))) {
+        d->conn->read_cb(d->conn, &d->src, d->src_len, (uint8_t *) d + RECVDATA_SIZE, d->len);
+      }
+      if (release_cb) {
+        release_cb(d);
+      }
     }
+
+    queue_release((queue_t *) block_queue, count);
   }
-  pthread_exit(NULL);
+
+  return NULL;
+}
+
+int receive_set_spin(uint32_t spins) {
+  receive_spin = spins;
+
+  return OK;
 }
 
-int receive_init(const queue_t *queue) {
+int receive_set_drain(receive_drain_t drain) {
+  if (drain != RECEIVE_DRAIN_FLUSH && drain != RECEIVE_DRAIN_DISCARD) return ERROR_ARG;
+
+  receive_drain = drain;
+
+  return OK;
+}
+
+uint32_t receive_fence_ticket() {
+  return __atomic_add_fetch(&fence_ticket, 1, __ATOMIC_RELAXED);
+}
+
+void receive_fence_fill(recv_data_t *d, uint32_t ticket) {
+  d->conn = &fence_conn;
+  d->src_len = 0;
+  d->len = ticket;
+}
+
+int receive_fence_wait(const queue_t *queue, uint32_t ticket, receive_fence_fn push, void *arg) {
+  struct receiver_s *rv = NULL;
+  struct timespec deadline;
+
+  for (uint32_t i = 0; i < receiver_cnt; ++i) {
+    if (receivers[i].queue == queue) rv = &receivers[i];
+  }
+  // no thread reads it, nothing to wait for
+  if (NULL == rv) return OK;
+
+  pthread_once(&fence_once, fence_init);
+  pthread_mutex_lock(&fence_lock);
+  while ((int32_t) (rv->fence - ticket) < 0) {
+    // the thread drains it on its own and leaves
+    if (QUEUE_CLOSED == queue_is_closed(queue)) break;
+
+    // again every round, a drop policy may have evicted the last one
+    if (push) {
+      pthread_mutex_unlock(&fence_lock);
+      push(arg, ticket);
+      pthread_mutex_lock(&fence_lock);
+      if ((int32_t) (rv->fence - ticket) >= 0) break;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += RECEIVE_FENCE_RETRY_MS * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&fence_cond, &fence_lock, &deadline);
+  }
+  pthread_mutex_unlock(&fence_lock);
+
+  return OK;
+}
+
+int receive_init(const queue_t *queue, receive_release_fn release) {
+  struct receiver_s *rv;
+
   if (NULL == queue) return ERROR_ARG;
+  if (receiver_cnt >= RECEIVE_MAX) return ERROR_THREAD;
 
-  block_queue = queue;
+  rv = &receivers[receiver_cnt];
+  rv->queue = queue;
+  rv->release = release;
+  rv->fence = __atomic_load_n(&fence_ticket, __ATOMIC_RELAXED);
 
-  if (0 > pthread_create(&cb_thread, NULL, thread_cost, NULL)) {
-    LOGE("pthread create error: %m");
+  if (OK != thread_create(&rv->thread, THREAD_ROLE_RECEIVE, "receive", thread_cost, rv)) {
     return ERROR_THREAD;
   }
-  pthread_detach(cb_thread);
+  receiver_cnt++;
 
   return OK;
 }
@@ -66,7 +198,14 @@ int receive_deinit()
 {
   LOGT("receive deinit");
 
-  pthread_cancel(cb_thread);
+  // closed already by a protocol that stopped, else nothing pushes any more
+  for (uint32_t i = 0; i < receiver_cnt; ++i) {
+    queue_close((queue_t *) receivers[i].queue);
+  }
+  for (uint32_t i = 0; i < receiver_cnt; ++i) {
+    pthread_join(receivers[i].thread, NULL);
+  }
+  receiver_cnt = 0;
 
   return OK;
-}
\ No newline at end of file
+}
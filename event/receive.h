@@ -24,8 +24,73 @@
 #include "protocol.h"
 
 
-int receive_init(const queue_t *queue);
+// callback threads, one per receive queue
+#define RECEIVE_MAX   16
 
+typedef void (*receive_release_fn)(recv_data_t *d);
+
+// how often receive_fence_wait() pushes its fence again
+#define RECEIVE_FENCE_RETRY_MS  10
+
+/**
+ * put a fence of ticket into the queue, from its producer thread
+ */
+typedef void (*receive_fence_fn)(void *arg, uint32_t ticket);
+
+typedef enum receive_drain_e {
+    // read_cb still gets everything queued before shutdown
+    RECEIVE_DRAIN_FLUSH,
+    // queued datagrams are only handed back to the protocol
+    RECEIVE_DRAIN_DISCARD,
+} receive_drain_t;
+
+/**
+ * start a callback thread on queue, once for every queue of the protocol
+ *
+ * @param queue   recv_data_t slots, or pointers to them for QUEUE_PTR_DATA queues
+ * @param release optional, hands a slot back to the protocol after read_cb
+ */
+int receive_init(const queue_t *queue, receive_release_fn release);
+
+/**
+ * Spin-then-park: a callback thread busy waits up to spins rounds for the
+ * next datagram before it sleeps on the queue. Costs a core per thread,
+ * saves the futex or condvar wakeup. 0 (default) sleeps at once.
+ */
+int receive_set_spin(uint32_t spins);
+
+/**
+ * what the callback threads do with datagrams still queued at shutdown,
+ * RECEIVE_DRAIN_FLUSH by default
+ */
+int receive_set_drain(receive_drain_t drain);
+
+/**
+ * A fence tells when a callback thread is done with everything queued
+ * before it, e.g. before the connection of those datagrams is freed.
+ * Take a ticket, have the producer of the queue fill a slot with
+ * receive_fence_fill() and push it behind the datagrams, and wait for it
+ * with receive_fence_wait(). The callback thread skips the slot, and does
+ * not release it.
+ */
+uint32_t receive_fence_ticket();
+
+void receive_fence_fill(recv_data_t *d, uint32_t ticket);
+
+/**
+ * Wait until the callback thread of queue got to the fence of ticket.
+ * Returns at once if no thread reads queue, or once it is closed, the
+ * thread then drains it by itself.
+ *
+ * @param push optional, called (again) every RECEIVE_FENCE_RETRY_MS to
+ *             push the fence, for queues whose drop policy may evict it
+ */
+int receive_fence_wait(const queue_t *queue, uint32_t ticket, receive_fence_fn push, void *arg);
+
+/**
+ * close the queues, wait until every callback thread drained its queue
+ * and exited
+ */
 int receive_deinit();
 
 queue_t *receive_get_queue();
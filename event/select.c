@@ -30,6 +30,7 @@
 #include <unistd.h>
 #include <error.h>
 #include "../error.h"
+#include "../timer.h"
 #include "select.h"
 
 
@@ -37,9 +38,12 @@ static fd_set readfds;
 static fd_set writefds;
 
 static connection_t *conns[1024];
+// a dispatched connection is left out of the fd_set until it is re-armed
+static uint8_t armed[1024];
 static uint32_t conn_cnt = 0;
 
 static queue_t *queue = NULL;
+// also wakes select up to take a re-armed connection back into the fd_set
 DECL_THREAD_CMD();
 
 static const char *TAG = "event";
@@ -47,9 +51,12 @@ static const char *TAG = "event";
 int select_add_connection(connection_t *c)
 {
   conns[conn_cnt] = (connection_t *) c;
+  armed[conn_cnt] = 1;
   c->index = conn_cnt;
   conn_cnt++;
 
+  WAKEUP_THREAD_CMD();
+
   return OK;
 }
 
@@ -64,31 +71,52 @@ int select_del_connection(const connection_t *c)
   if (c->index < --conn_cnt) {
     tmp = conns[conn_cnt];
     conns[c->index] = tmp;
+    armed[c->index] = armed[conn_cnt];
     tmp->index = c->index;
   }
 
   return OK;
 }
 
+int select_rearm_connection(connection_t *c)
+{
+  if (c->index >= conn_cnt || conns[c->index] != c) {
+    return OK;
+  }
+
+  __atomic_store_n(&armed[c->index], 1, __ATOMIC_RELEASE);
+  WAKEUP_THREAD_CMD();
+
+  return OK;
+}
+
 int select_stop_process()
 {
-  DEINIT_THREAD_CMD();
+  WRITE_EXIT_THREAD_CMD();
 
   return OK;
 }
 
 int select_process() {
-  int ready, n, rn;
+  int ready, n;
   socket_t max_fd = -1;
   connection_t *c;
   static struct timeval tv = {0};
+  int tfd = timer_fd(), tick_ms = timer_next_ms();
 
   FD_ZERO(&readfds);
   FD_ZERO(&writefds);
 
   ADD_THREAD_CMD(&readfds);
+  max_fd = THREAD_CMD_FD();
+  if (tfd >= 0) {
+    FD_SET(tfd, &readfds);
+    if (max_fd < tfd) max_fd = tfd;
+  }
 
   for (int i = 0; i < conn_cnt; ++i) {
+    if (!__atomic_load_n(&armed[i], __ATOMIC_ACQUIRE)) continue;
+
     c = conns[i];
     FD_SET(c->read_fd, &readfds);
 
@@ -99,6 +127,11 @@ int select_process() {
 
   tv.tv_sec = 3;
   tv.tv_usec = 0;
+  // without a timerfd the timeout is the timer tick
+  if (tfd < 0 && tick_ms >= 0) {
+    tv.tv_sec = tick_ms / 1000;
+    tv.tv_usec = (tick_ms % 1000) * 1000;
+  }
 
 #if WIN32
   ready = select(0, &readfds, NULL, NULL, &tv);
@@ -112,32 +145,32 @@ int select_process() {
   }
 
   if (ready == 0) {
+    if (tfd < 0 && tick_ms >= 0) return timer_process();
     LOGT("select timeout");
     return -2;
   }
 
-  n = rn = 0;
+  CHK_CMD_EXIT_THREAD(&readfds);
+
+  n = FD_ISSET(THREAD_CMD_FD(), &readfds) ? 1 : 0;
+  if (tfd < 0 || FD_ISSET(tfd, &readfds)) {
+    timer_process();
+    if (tfd >= 0) n++;
+  }
+
   for (int i = 0; i < conn_cnt; ++i) {
     c = conns[i];
-    if (FD_ISSET(c->read_fd, &readfds)) {
-      if (c->readed) {
-        c->readed = 0;
-        queue_normal_push(queue, &c, NULL);
-      } else {
-        rn++;
-      }
+    if (armed[i] && FD_ISSET(c->read_fd, &readfds)) {
+      armed[i] = 0;
+      queue_normal_push(queue, &c, NULL);
       n++;
     }
-    CHK_CMD_EXIT_THREAD(&readfds);
   }
 
   if (ready != n) {
     LOGE("select ready != connection: %d != %d", ready, n);
     return -1;
   }
-  if (n != rn) {
-    usleep(10);
-  }
 
   return OK;
 }
@@ -150,7 +183,7 @@ const queue_t *select_get_queue()
 queue_t *select_init() {
   conn_cnt = 0;
 
-  if (queue != NULL) return 0;
+  if (queue != NULL) return queue;
 
   INIT_THREAD_CMD("select");
 
@@ -169,7 +202,9 @@ int select_deinit()
   conn_cnt = 0;
 
   queue_destory(queue);
+  queue = NULL;
   select_stop_process();
+  DEINIT_THREAD_CMD();
 
   return 0;
 }
@@ -181,6 +216,7 @@ event_t event_select_ = {
 
   select_add_connection,
   select_del_connection,
+  select_rearm_connection,
 
   select_get_queue,
 
@@ -37,6 +37,8 @@ int select_add_connection(connection_t *c);
 
 int select_del_connection(const connection_t *c);
 
+int select_rearm_connection(connection_t *c);
+
 int select_process();
 
 int select_stop_process();
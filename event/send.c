@@ -17,4 +17,354 @@
 */
 
 
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <string.h>
+#include <errno.h>
+#if !WIN32
+#include <sys/socket.h>
+#endif
+#ifdef __linux__
+#include <netinet/udp.h>
+#endif
+#include "../log.h"
+#include "../error.h"
 #include "send.h"
+
+
+LOG_TAG_DECLR("event");
+
+static void send_failed(speaker_t *sp, const struct sockaddr_storage *addr)
+{
+  sp->statistic.error++;
+  LOGD("send to speaker %u(%s:%d) error: %m", sp->id, sockaddr_ntop(addr), sockaddr_port(addr));
+}
+
+#ifdef __linux__
+
+enum {
+  GSO_UNKNOWN = -1,
+  GSO_OFF = 0,
+  GSO_ON = 1,
+};
+
+static int gso_state = GSO_UNKNOWN;
+
+// the socket whose TX stamps go to stamp_cb, if any
+static socket_t stamp_fd = -1;
+static send_stamp_fn stamp_cb = NULL;
+static void *stamp_arg = NULL;
+
+/**
+ * hand the TX stamps queued on fd so far to stamp_cb, else they pile up in
+ * the error queue and keep it readable
+ */
+static void reap_stamps(socket_t fd)
+{
+  struct timespec ts;
+  timestamp_clock_t clk;
+  uint32_t id;
+
+  if (fd != stamp_fd) return;
+
+  while (OK == timestamp_read_tx(fd, &id, &ts, &clk))
+    stamp_cb(id, &ts, clk, stamp_arg);
+}
+
+/**
+ * send a UDP_SEGMENT message as the datagrams it stands for, to its one
+ * destination, after the device refused to segment it
+ *
+ * @return 1 if every datagram went out, else 0
+ */
+static int send_split(socket_t fd, const struct msghdr *hdr, speaker_t *sp, const struct sockaddr_storage *addr)
+{
+  struct cmsghdr *cm = CMSG_FIRSTHDR(hdr);
+  uint16_t seg_size = NULL == cm ? 0 : *(uint16_t *) CMSG_DATA(cm);
+  const uint8_t *data = hdr->msg_iov[0].iov_base;
+  size_t size = hdr->msg_iov[0].iov_len, off, n;
+
+  if (NULL == cm) {
+    if (sendmsg(fd, hdr, 0) >= 0) return 1;
+    send_failed(sp, addr);
+    return 0;
+  }
+
+  for (off = 0; off < size; off += n) {
+    n = size - off < seg_size ? size - off : seg_size;
+    if (sendto(fd, data + off, n, 0, hdr->msg_name, hdr->msg_namelen) < 0) {
+      send_failed(sp, addr);
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/**
+ * flush count prepared messages, skipping the ones the kernel refuses
+ */
+static int send_batch(socket_t fd, struct mmsghdr *msgs, speaker_t **sps,
+                      const struct sockaddr_storage *addrs, uint32_t count)
+{
+  uint32_t i = 0;
+  int sent = 0, n;
+
+  while (i < count) {
+    n = sendmmsg(fd, msgs + i, count - i, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EIO && NULL != msgs[i].msg_hdr.msg_control) {
+        // the device can not checksum segments, later chunks go per packet
+        if (GSO_ON == gso_state) {
+          LOGW("udp segmentation offload failed, disabled");
+          gso_state = GSO_OFF;
+        }
+        // the rest of the batch carries the same segmentation, split them here
+        for (; i < count; i++)
+          sent += send_split(fd, &msgs[i].msg_hdr, sps[i], &addrs[i]);
+        break;
+      }
+      // sendmmsg stops at the first failing message and reports it on the next call
+      send_failed(sps[i], &addrs[i]);
+      i++;
+      continue;
+    }
+    sent += n;
+    i += n;
+  }
+
+  return sent;
+}
+
+/**
+ * send the same iovec, and control message if any, to every speaker of list
+ */
+static int fan_out(socket_t fd, struct iovec *iov, size_t iovcnt, void *control, size_t controllen,
+                   speaker_list_t *list)
+{
+  struct mmsghdr msgs[SEND_BATCH_MAX];
+  struct sockaddr_storage addrs[SEND_BATCH_MAX];
+  speaker_t *sps[SEND_BATCH_MAX];
+  uint32_t count = 0;
+  int sent = 0;
+  socklen_t len;
+
+  for (uint32_t i = 0; i < list->len; ++i) {
+    speaker_t *sp = list->speakers[i];
+
+    // change_channel() leaves holes, offline speakers are not sent to
+    if (NULL == sp || !SPEAKER_IS_ONLINE(sp) || 0 == sp->dport) continue;
+
+    memset(&addrs[count], 0, sizeof(addrs[count]));
+    len = set_sockaddr(&addrs[count], &sp->ip, sp->dport);
+    if (0 == len) continue;
+
+    memset(&msgs[count], 0, sizeof(msgs[count]));
+    msgs[count].msg_hdr.msg_name = &addrs[count];
+    msgs[count].msg_hdr.msg_namelen = len;
+    msgs[count].msg_hdr.msg_iov = iov;
+    msgs[count].msg_hdr.msg_iovlen = iovcnt;
+    msgs[count].msg_hdr.msg_control = control;
+    msgs[count].msg_hdr.msg_controllen = controllen;
+    sps[count] = sp;
+
+    if (++count == SEND_BATCH_MAX) {
+      sent += send_batch(fd, msgs, sps, addrs, count);
+      count = 0;
+    }
+  }
+
+  if (count) sent += send_batch(fd, msgs, sps, addrs, count);
+
+  reap_stamps(fd);
+
+  return sent;
+}
+
+int send_chunk(socket_t fd, const void *data, size_t size, speaker_list_t *list)
+{
+  // every destination gets the same payload
+  struct iovec iov = {.iov_base = (void *) data, .iov_len = size};
+
+  if (NULL == list || NULL == data) return ERROR_ARG;
+
+  return fan_out(fd, &iov, 1, NULL, 0, list);
+}
+
+int send_iov(socket_t fd, const struct iovec *iov, int iovcnt, speaker_list_t *list)
+{
+  if (NULL == list || NULL == iov || iovcnt <= 0) return ERROR_ARG;
+
+  // the kernel gathers the pieces, the payload is never assembled here
+  return fan_out(fd, (struct iovec *) iov, iovcnt, NULL, 0, list);
+}
+
+static int gso_supported(socket_t fd)
+{
+  int seg = 0;
+  socklen_t len = sizeof(seg);
+
+  if (GSO_UNKNOWN == gso_state) {
+    // kernels before 4.18 do not know the option
+    gso_state = getsockopt(fd, SOL_UDP, UDP_SEGMENT, &seg, &len) < 0 ? GSO_OFF : GSO_ON;
+    LOGI("udp segmentation offload %s", GSO_ON == gso_state ? "enabled" : "not supported");
+  }
+
+  return GSO_ON == gso_state;
+}
+
+int send_stamp_enable(socket_t fd, send_stamp_fn cb, void *arg)
+{
+  int ret;
+
+  if (NULL == cb) return ERROR_ARG;
+
+  ret = timestamp_enable(fd, TIMESTAMP_TX);
+  if (OK != ret) return ret;
+
+  stamp_cb = cb;
+  stamp_arg = arg;
+  stamp_fd = fd;
+
+  return OK;
+}
+
+int send_segments(socket_t fd, const void *data, size_t size, uint16_t seg_size, speaker_list_t *list)
+{
+  union {
+      char buf[CMSG_SPACE(sizeof(uint16_t))];
+      struct cmsghdr align;
+  } control;
+  struct cmsghdr *cm;
+  struct iovec iov;
+  size_t max, off, n;
+  int sent = 0;
+
+  if (NULL == list || NULL == data || 0 == seg_size) return ERROR_ARG;
+
+  if (size <= seg_size || !gso_supported(fd)) {
+    for (off = 0; off < size; off += seg_size) {
+      n = size - off < seg_size ? size - off : seg_size;
+      sent += send_chunk(fd, data + off, n, list);
+    }
+    return sent;
+  }
+
+  memset(&control, 0, sizeof(control));
+  cm = (struct cmsghdr *) control.buf;
+  cm->cmsg_level = SOL_UDP;
+  cm->cmsg_type = UDP_SEGMENT;
+  cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+  *(uint16_t *) CMSG_DATA(cm) = seg_size;
+
+  // the kernel caps both the segment count and the datagram size
+  max = SEND_GSO_MAX_SIZE / seg_size;
+  if (max > SEND_GSO_MAX_SEGMENTS) max = SEND_GSO_MAX_SEGMENTS;
+  max *= seg_size;
+
+  for (off = 0; off < size; off += n) {
+    n = size - off < max ? size - off : max;
+    if (GSO_ON != gso_state) {
+      // turned off by a failed send, finish per packet
+      sent += send_segments(fd, data + off, size - off, seg_size, list);
+      break;
+    }
+    iov.iov_base = (void *) data + off;
+    iov.iov_len = n;
+    // count datagrams on the wire, not super buffers
+    sent += fan_out(fd, &iov, 1, n > seg_size ? control.buf : NULL, n > seg_size ? sizeof(control.buf) : 0, list)
+            * (int) ((n + seg_size - 1) / seg_size);
+  }
+
+  return sent;
+}
+
+#else
+
+int send_chunk(socket_t fd, const void *data, size_t size, speaker_list_t *list)
+{
+  struct sockaddr_storage addr;
+  int sent = 0;
+  socklen_t len;
+
+  if (NULL == list || NULL == data) return ERROR_ARG;
+
+  for (uint32_t i = 0; i < list->len; ++i) {
+    speaker_t *sp = list->speakers[i];
+
+    if (NULL == sp || !SPEAKER_IS_ONLINE(sp) || 0 == sp->dport) continue;
+
+    memset(&addr, 0, sizeof(addr));
+    len = set_sockaddr(&addr, &sp->ip, sp->dport);
+    if (0 == len) continue;
+
+    if (sendto(fd, data, size, 0, (struct sockaddr *) &addr, len) < 0) {
+      send_failed(sp, &addr);
+      continue;
+    }
+    sent++;
+  }
+
+  return sent;
+}
+
+int send_iov(socket_t fd, const struct iovec *iov, int iovcnt, speaker_list_t *list)
+{
+  struct sockaddr_storage addr;
+  struct msghdr msg;
+  int sent = 0;
+  socklen_t len;
+
+  if (NULL == list || NULL == iov || iovcnt <= 0) return ERROR_ARG;
+
+  for (uint32_t i = 0; i < list->len; ++i) {
+    speaker_t *sp = list->speakers[i];
+
+    if (NULL == sp || !SPEAKER_IS_ONLINE(sp) || 0 == sp->dport) continue;
+
+    memset(&addr, 0, sizeof(addr));
+    len = set_sockaddr(&addr, &sp->ip, sp->dport);
+    if (0 == len) continue;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &addr;
+    msg.msg_namelen = len;
+    msg.msg_iov = (struct iovec *) iov;
+    msg.msg_iovlen = iovcnt;
+
+    if (sendmsg(fd, &msg, 0) < 0) {
+      send_failed(sp, &addr);
+      continue;
+    }
+    sent++;
+  }
+
+  return sent;
+}
+
+int send_segments(socket_t fd, const void *data, size_t size, uint16_t seg_size, speaker_list_t *list)
+{
+  int sent = 0;
+  size_t n;
+
+  if (NULL == list || NULL == data || 0 == seg_size) return ERROR_ARG;
+
+  for (size_t off = 0; off < size; off += seg_size) {
+    n = size - off < seg_size ? size - off : seg_size;
+    sent += send_chunk(fd, data + off, n, list);
+  }
+
+  return sent;
+}
+
+int send_stamp_enable(socket_t fd, send_stamp_fn cb, void *arg)
+{
+  if (NULL == cb) return ERROR_ARG;
+
+  return timestamp_enable(fd, TIMESTAMP_TX);
+}
+
+#endif
@@ -20,5 +20,58 @@
 #ifndef SEND_H
 #define SEND_H
 
+#include <stddef.h>
+#if !WIN32
+#include <sys/uio.h>
+#endif
+#include "../common.h"
+#include "../speaker_struct.h"
+#include "timestamp.h"
+
+// destinations per sendmmsg() call
+#define SEND_BATCH_MAX      64
+// kernel limits of one UDP_SEGMENT send
+#define SEND_GSO_MAX_SEGMENTS   64
+#define SEND_GSO_MAX_SIZE       65507
+
+typedef void (*send_stamp_fn)(uint32_t id, const struct timespec *ts, timestamp_clock_t clk, void *arg);
+
+/**
+ * Send one chunk to every speaker of list (e.g. speakers_list_ch[line][ch])
+ * at its ip:dport, with one sendmmsg() per SEND_BATCH_MAX speakers.
+ * A failed destination counts in its statistic.error and does not stop
+ * the others.
+ *
+ * @return speakers the chunk was sent to, or ERROR_ARG
+ */
+int send_chunk(socket_t fd, const void *data, size_t size, speaker_list_t *list);
+
+/**
+ * send_chunk() for a datagram gathered from iovcnt pieces, e.g. a
+ * pcm_packet_t header and its samples from pcm_packet_iov()
+ */
+int send_iov(socket_t fd, const struct iovec *iov, int iovcnt, speaker_list_t *list);
+
+/**
+ * Send a chunk made of seg_size datagrams (the last may be shorter) to
+ * every speaker of list. With UDP_SEGMENT the kernel cuts it up and each
+ * speaker costs one message per 64 segments, without it, or after the
+ * device refused it, every datagram goes through send_chunk().
+ *
+ * @return datagrams sent, or ERROR_ARG
+ */
+int send_segments(socket_t fd, const void *data, size_t size, uint16_t seg_size, speaker_list_t *list);
+
+/**
+ * Turn on TX timestamps for fd and hand them to cb. After every fan out on
+ * fd the stamps queued so far are read from the error queue, so the stamps
+ * of one send usually arrive during a later one. id counts the messages
+ * sent on fd from 0, one per speaker in list order. A UDP_SEGMENT message
+ * is one, unless the device refused it and it went out per datagram. Only
+ * one socket is stamped at a time, call before sending.
+ *
+ * @return OK, ERROR_ARG, or ERROR_SOCKET if the kernel refuses
+ */
+int send_stamp_enable(socket_t fd, send_stamp_fn cb, void *arg);
 
 #endif //SEND_H
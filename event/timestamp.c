@@ -0,0 +1,138 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <string.h>
+#include <errno.h>
+#ifdef __linux__
+#include <netinet/in.h>
+#include <linux/net_tstamp.h>
+#endif
+#include "../log.h"
+#include "../error.h"
+#include "timestamp.h"
+
+
+LOG_TAG_DECLR("event");
+
+#ifdef __linux__
+
+int timestamp_enable(socket_t fd, uint32_t flags)
+{
+  int opt = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+  int on = 1;
+
+  if (flags & TIMESTAMP_RX) {
+    opt |= SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_RX_HARDWARE;
+  }
+  if (flags & TIMESTAMP_TX) {
+    // only the stamp comes back on the error queue, keyed by a packet counter
+    opt |= SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_TX_HARDWARE
+           | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+  }
+
+  if (0 == setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &opt, sizeof(opt))) return OK;
+
+  if ((flags & TIMESTAMP_RX) && 0 == setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on))) {
+    LOGW("SO_TIMESTAMPING error: %m, receive stamps only");
+    return (flags & TIMESTAMP_TX) ? ERROR_SOCKET : OK;
+  }
+
+  LOGE("timestamping on fd %d error: %m", fd);
+
+  return ERROR_SOCKET;
+}
+
+int timestamp_parse(const struct msghdr *msg, struct timespec *ts, timestamp_clock_t *clk)
+{
+  struct cmsghdr *cm;
+  const struct scm_timestamping *st;
+
+  for (cm = CMSG_FIRSTHDR(msg); cm; cm = CMSG_NXTHDR((struct msghdr *) msg, cm)) {
+    if (cm->cmsg_level != SOL_SOCKET) continue;
+
+    if (cm->cmsg_type == SCM_TIMESTAMPING) {
+      st = (const struct scm_timestamping *) CMSG_DATA(cm);
+      // ts[2] is the raw NIC clock, ts[0] the stack
+      if (st->ts[2].tv_sec || st->ts[2].tv_nsec) {
+        *ts = st->ts[2];
+        *clk = TIMESTAMP_CLOCK_HARDWARE;
+      } else {
+        *ts = st->ts[0];
+        *clk = TIMESTAMP_CLOCK_SOFTWARE;
+      }
+      return OK;
+    }
+    if (cm->cmsg_type == SCM_TIMESTAMPNS) {
+      memcpy(ts, CMSG_DATA(cm), sizeof(*ts));
+      *clk = TIMESTAMP_CLOCK_SOFTWARE;
+      return OK;
+    }
+  }
+
+  return ERROR_ARG;
+}
+
+int timestamp_read_tx(socket_t fd, uint32_t *id, struct timespec *ts, timestamp_clock_t *clk)
+{
+  char control[TIMESTAMP_CONTROL_SIZE + CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+  struct msghdr msg;
+  struct cmsghdr *cm;
+  const struct sock_extended_err *ee;
+  int stamped = 0, keyed = 0;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  // OPT_TSONLY leaves no payload, only the control messages
+  if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) return ERROR_SOCKET;
+
+  for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+    if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPING) {
+      stamped = OK == timestamp_parse(&msg, ts, clk);
+    } else if ((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+               || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+      ee = (const struct sock_extended_err *) CMSG_DATA(cm);
+      if (ee->ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+        *id = ee->ee_data;
+        keyed = 1;
+      }
+    }
+  }
+
+  return (stamped && keyed) ? OK : ERROR_SOCKET;
+}
+
+#else
+
+int timestamp_enable(socket_t fd, uint32_t flags)
+{
+  LOGE("timestamping not supported");
+  return ERROR_SOCKET;
+}
+
+int timestamp_read_tx(socket_t fd, uint32_t *id, struct timespec *ts, timestamp_clock_t *clk)
+{
+  return ERROR_SOCKET;
+}
+
+#endif
@@ -0,0 +1,79 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef TIMESTAMP_H
+#define TIMESTAMP_H
+
+#include <stdint.h>
+#include <time.h>
+#include "../common.h"
+#include "../connection.h"
+
+#ifdef __linux__
+#include <linux/errqueue.h>
+
+// room for the receive timestamps of one datagram
+#define TIMESTAMP_CONTROL_SIZE \
+    (CMSG_SPACE(sizeof(struct scm_timestamping)) + CMSG_SPACE(sizeof(struct timespec)))
+#else
+#define TIMESTAMP_CONTROL_SIZE  0
+#endif
+
+typedef enum timestamp_flag_e {
+    TIMESTAMP_RX = 1,
+    TIMESTAMP_TX = 2,
+} timestamp_flag_t;
+
+// the clock a receive stamp was taken from, stamps of different clocks do not compare
+typedef enum timestamp_clock_e {
+    TIMESTAMP_CLOCK_NONE = 0,
+    // the stack, CLOCK_REALTIME
+    TIMESTAMP_CLOCK_SOFTWARE,
+    // the raw NIC clock (PHC), only comparable with other stamps of the same NIC
+    TIMESTAMP_CLOCK_HARDWARE,
+} timestamp_clock_t;
+
+/**
+ * Ask the kernel to stamp datagrams of fd: RX when they are received, TX
+ * when they leave, both from the NIC if it stamps in hardware and from the
+ * stack otherwise. RX falls back to SO_TIMESTAMPNS on kernels without
+ * SO_TIMESTAMPING. Received stamps show up in recv_data_t.stamp.
+ */
+int timestamp_enable(socket_t fd, uint32_t flags);
+
+#ifdef __linux__
+/**
+ * find the receive timestamp in the control messages of msg, hardware first.
+ * clk tells which clock ts was taken from.
+ *
+ * @return OK, or ERROR_ARG if the datagram has none
+ */
+int timestamp_parse(const struct msghdr *msg, struct timespec *ts, timestamp_clock_t *clk);
+#endif
+
+/**
+ * Read one TX timestamp from the error queue of fd without blocking. id
+ * counts the datagrams sent on fd since TX stamping was enabled, starting
+ * at 0, clk is as for timestamp_parse(). The error queue is readable when
+ * epoll reports EPOLLERR.
+ *
+ * @return OK, or ERROR_SOCKET if no stamp is queued
+ */
+int timestamp_read_tx(socket_t fd, uint32_t *id, struct timespec *ts, timestamp_clock_t *clk);
+
+#endif //TIMESTAMP_H
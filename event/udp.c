@@ -17,6 +17,10 @@
 */
 
 
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <stddef.h>
 #include <pthread.h>
 #include <errno.h>
@@ -25,8 +29,19 @@
 #include "../common.h"
 #include "../connection.h"
 #include "../block_queue.h"
+#include "../error.h"
+#include "../thread.h"
+#include "../speaker_struct.h"
+#ifdef __linux__
+#include <unistd.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <linux/filter.h>
+#endif
 #include "udp.h"
 #include "event.h"
+#include "timestamp.h"
+#include "receive.h"
 
 
 static pthread_t recv_thread;
@@ -39,14 +54,41 @@ static struct thread_arg_s {
     uint32_t len;
 } thread_arg;
 
+static uint32_t recv_batch = 1;
+static uint32_t recv_policy = 0;
+static uint32_t *recv_drop_counter = NULL;
+static uint32_t shard_cnt = 1;
+// SO_BUSY_POLL of every socket, 0 is off
+static uint32_t busy_poll_usec = 0;
+// empty reads in a row before handing a connection back to the backend
+static uint32_t busy_poll_budget = 0;
+
+/**
+ * what a receiving thread reads sockets into
+ */
+typedef struct udp_reader_s {
+    queue_t *queue;
+#ifdef __linux__
+    struct mmsghdr msgs[UDP_RECV_BATCH_MAX];
+    struct iovec iovs[UDP_RECV_BATCH_MAX];
+    // receive timestamps, if the socket asked for them
+    uint64_t control[UDP_RECV_BATCH_MAX][(TIMESTAMP_CONTROL_SIZE + 7) / 8];
+#endif
+} udp_reader_t;
+
+static udp_reader_t main_reader;
+
 LOG_TAG_DECLR("event");
 
 int send_data(const void *data, size_t size) {
-
+  return ERROR_ARG;
 }
 
-static int push_recv(void *arg, queue_t *q, void *data, uint32_t size) {
-  connection_t *c = *((connection_t **) arg);
+#ifndef __linux__
+/**
+ * read one datagram into a reserved slot, return the number of slots filled
+ */
+static int recv_slot(connection_t *c, void *data, uint32_t size) {
   recv_data_t *ud = (recv_data_t *) data;
 
   ud->conn = c;
@@ -55,10 +97,13 @@ static int push_recv(void *arg, queue_t *q, void *data, uint32_t size) {
   LOGT("recvfrom start");
   ssize_t s = recvfrom(c->read_fd,
                        data + RECVDATA_SIZE, size - RECVDATA_SIZE,
-                       0,
+                       MSG_DONTWAIT,
                        (struct sockaddr *) &ud->src, &ud->src_len);
 
   if (0 > s) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return 0;
+    }
     LOGE("recvfrom error: %m");
     if (errno == ECONNREFUSED) {
       LOGW("server(%s:%d) unreachable :%m. quit", sockaddr_ntop(&ud->src), sockaddr_port(&ud->src));
@@ -68,31 +113,511 @@ static int push_recv(void *arg, queue_t *q, void *data, uint32_t size) {
     return -1;
   }
 
-  c->readed = 1;
   ud->len = s;
+  ud->stamp.tv_sec = ud->stamp.tv_nsec = 0;
+  ud->stamp_clock = TIMESTAMP_CLOCK_NONE;
 
   if (0 == s) {
     LOGW("recvfrom received 0");
-    return 0;
   }
 
+  return 1;
+}
+#endif
 
-  return 0;
+#ifdef __linux__
+/**
+ * read up to count datagrams into consecutive reserved slots
+ */
+static int recv_slots(udp_reader_t *rd, connection_t *c, void *data, uint32_t size, uint32_t count) {
+  struct mmsghdr *recv_msgs = rd->msgs;
+  struct iovec *recv_iovs = rd->iovs;
+  recv_data_t *ud;
+  int n;
+
+  for (uint32_t i = 0; i < count; ++i) {
+    ud = (recv_data_t *) (data + i * size);
+    recv_iovs[i].iov_base = data + i * size + RECVDATA_SIZE;
+    recv_iovs[i].iov_len = size - RECVDATA_SIZE;
+    recv_msgs[i].msg_hdr.msg_name = &ud->src;
+    recv_msgs[i].msg_hdr.msg_namelen = SOCKADDR_SIZE(c->family);
+    recv_msgs[i].msg_hdr.msg_iov = &recv_iovs[i];
+    recv_msgs[i].msg_hdr.msg_iovlen = 1;
+    recv_msgs[i].msg_hdr.msg_control = rd->control[i];
+    recv_msgs[i].msg_hdr.msg_controllen = sizeof(rd->control[i]);
+    recv_msgs[i].msg_hdr.msg_flags = 0;
+  }
+
+  LOGT("recvmmsg start");
+  // the socket is readable, take whatever is queued without blocking
+  n = recvmmsg(c->read_fd, recv_msgs, count, MSG_DONTWAIT, NULL);
+
+  if (0 > n) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return 0;
+    }
+    LOGE("recvmmsg error: %m");
+    if (errno == ECONNREFUSED) {
+      LOGW("server unreachable :%m. quit");
+      if (c->refuse_cb) c->refuse_cb();
+    }
+
+    return -1;
+  }
+
+  for (int i = 0; i < n; ++i) {
+    ud = (recv_data_t *) (data + i * size);
+    ud->conn = c;
+    ud->src_len = recv_msgs[i].msg_hdr.msg_namelen;
+    ud->len = recv_msgs[i].msg_len;
+    if (0 == recv_msgs[i].msg_hdr.msg_controllen || OK != timestamp_parse(&recv_msgs[i].msg_hdr, &ud->stamp, &ud->stamp_clock)) {
+      ud->stamp.tv_sec = ud->stamp.tv_nsec = 0;
+      ud->stamp_clock = TIMESTAMP_CLOCK_NONE;
+    }
+  }
+
+  return n;
+}
+#endif
+
+/**
+ * @return datagrams read
+ */
+static int recv_connection(udp_reader_t *rd, connection_t *conn) {
+  queue_t *recv_queue = rd->queue;
+  void *slot;
+  uint32_t count;
+  int n, total = 0;
+
+  do {
+    // the socket is read straight into the queue, outside of its lock
+    count = recv_batch;
+    if (QUEUE_OK != queue_reserve(recv_queue, &slot, &count, NULL)) {
+      return total;
+    }
+
+#ifdef __linux__
+    n = recv_slots(rd, conn, slot, recv_queue->size, count);
+#else
+    n = recv_slot(conn, slot, recv_queue->size);
+#endif
+
+    if (n > 0) {
+      queue_commit(recv_queue, n);
+      total += n;
+    }
+
+    // a short read means the socket buffer is empty
+  } while (conn->drain && n > 0 && n == count && !exit_thread_flag);
+
+  return total;
+}
+
+/**
+ * Keep reading conns instead of waiting for readiness again, until
+ * busy_poll_budget rounds in a row find nothing or other connections
+ * show up in pending (may be NULL).
+ */
+static void busy_poll(udp_reader_t *rd, connection_t **conns, uint32_t count, queue_t *pending) {
+  uint32_t idle = 0;
+  int got;
+
+  while (idle < busy_poll_budget && !exit_thread_flag) {
+    got = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+      got += recv_connection(rd, conns[i]);
+    }
+    idle = got > 0 ? 0 : idle + 1;
+
+    if (pending && (QUEUE_EMPTY != queue_is_empty(pending) || QUEUE_CLOSED == queue_is_closed(pending))) break;
+  }
+}
+
+int udp_set_recv_batch(uint32_t n) {
+  if (n == 0 || n > UDP_RECV_BATCH_MAX) return ERROR_ARG;
+
+  recv_batch = n;
+
+  return OK;
+}
+
+/**
+ * charge a datagram the receive queue dropped to the speaker it came from
+ */
+static void recv_dropped(const void *data, void *arg) {
+  const recv_data_t *d = (const recv_data_t *) data;
+  speaker_t *sp;
+
+  // a fence has no source
+  if (0 == d->src_len) return;
+
+  sp = find_speaker_by_addr((const struct sockaddr *) &d->src, d->src_len);
+  if (NULL != sp) __atomic_add_fetch(&sp->statistic.drop, d->len, __ATOMIC_RELAXED);
+}
+
+int udp_set_recv_policy(uint32_t policy, uint32_t *drop_counter) {
+  if (policy & ~QUEUE_DROP_POLICY || policy == QUEUE_DROP_POLICY) return ERROR_ARG;
+
+  recv_policy = policy;
+  recv_drop_counter = drop_counter;
+
+  return OK;
+}
+
+int udp_set_busy_poll(uint32_t usec, uint32_t budget) {
+#ifndef __linux__
+  if (usec || budget) return ERROR_ARG;
+#endif
+
+  busy_poll_usec = usec;
+  busy_poll_budget = budget;
+
+  return OK;
+}
+
+#ifdef __linux__
+
+/**
+ * Shard 0 is the connection itself, served by the event backend. Every
+ * other shard reads its own SO_REUSEPORT sockets on its own thread into
+ * its own queue, one receive thread each, so one source always ends up
+ * in the same queue and keeps its order.
+ */
+static struct udp_shard_s {
+    pthread_t thread;
+    int epfd;
+    wakeup_t wakeup;
+    volatile int stop;
+    // bumped before every epoll_wait(), set when the thread is gone
+    uint32_t loop;
+    uint32_t exited;
+    // fence ticket to push into the queue, 0 for none
+    uint32_t fence;
+    udp_reader_t reader;
+} shards[UDP_SHARDS_MAX];
+
+static struct shard_conn_s {
+    const connection_t *origin;
+    connection_t clone[UDP_SHARDS_MAX];
+} shard_conns[UDP_SHARD_CONN_MAX];
+
+static pthread_mutex_t shard_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * the shard thread is the producer of its queue, only it pushes a fence
+ */
+static void shard_push_fence(struct udp_shard_s *sh)
+{
+  uint32_t ticket = __atomic_exchange_n(&sh->fence, 0, __ATOMIC_ACQ_REL), count = 1;
+  void *slot;
+
+  if (0 == ticket) return;
+  if (QUEUE_OK != queue_reserve(sh->reader.queue, &slot, &count, NULL)) return;
+
+  receive_fence_fill((recv_data_t *) slot, ticket);
+  queue_commit(sh->reader.queue, 1);
+}
+
+static void shard_fence(void *arg, uint32_t ticket)
+{
+  struct udp_shard_s *sh = (struct udp_shard_s *) arg;
+
+  __atomic_store_n(&sh->fence, ticket, __ATOMIC_RELEASE);
+  wakeup_signal(&sh->wakeup);
+}
+
+static void *shard_thread(void *arg)
+{
+  struct udp_shard_s *sh = (struct udp_shard_s *) arg;
+  struct epoll_event events[UDP_EVENT_BATCH];
+  connection_t *conns[UDP_EVENT_BATCH];
+  uint32_t n;
+  int ready;
+
+  while (!exit_thread_flag) {
+    // the connections of the last batch are not touched any more
+    __atomic_add_fetch(&sh->loop, 1, __ATOMIC_RELEASE);
+    ready = epoll_wait(sh->epfd, events, UDP_EVENT_BATCH, -1);
+    if (ready < 0) {
+      if (errno == EINTR) continue;
+      LOGE("shard epoll error: %m");
+      break;
+    }
+
+    n = 0;
+    for (int i = 0; i < ready; ++i) {
+      // the wakeup is registered without a connection
+      if (NULL == events[i].data.ptr) {
+        wakeup_drain(&sh->wakeup);
+        if (sh->stop) goto exit_thread;
+        shard_push_fence(sh);
+        continue;
+      }
+      recv_connection(&sh->reader, events[i].data.ptr);
+      conns[n++] = events[i].data.ptr;
+    }
+
+    if (busy_poll_budget && n > 0) busy_poll(&sh->reader, conns, n, NULL);
+  }
+
+exit_thread:
+  __atomic_store_n(&sh->exited, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+/**
+ * Wait until the shard thread is done with the events it already has,
+ * after a connection was removed from its epoll set, so the connection
+ * can be closed and its slot reused.
+ */
+static void shard_quiesce(struct udp_shard_s *sh)
+{
+  uint32_t loop = __atomic_load_n(&sh->loop, __ATOMIC_ACQUIRE);
+
+  if (0 == sh->thread) return;
+
+  wakeup_signal(&sh->wakeup);
+  while (loop == __atomic_load_n(&sh->loop, __ATOMIC_ACQUIRE) && !__atomic_load_n(&sh->exited, __ATOMIC_ACQUIRE))
+    sched_yield();
+}
+
+/**
+ * send every datagram of one source address to the same shard, the
+ * kernel hashes the 4-tuple otherwise
+ */
+static int shard_steer(int fd, sa_family_t family)
+{
+  struct sock_filter code[] = {
+    // last word of the source address
+    {BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t) SKF_NET_OFF + (family == AF_INET6 ? 20 : 12)},
+    {BPF_ALU | BPF_MOD | BPF_K, 0, 0, shard_cnt},
+    {BPF_RET | BPF_A, 0, 0, 0},
+  };
+  struct sock_fprog prog = {.len = sizeof(code) / sizeof(code[0]), .filter = code};
+
+  if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+    LOGW("reuseport steering failed, shards follow the kernel hash: %m");
+    return ERROR_SOCKET;
+  }
+
+  return OK;
+}
+
+static void shard_close(struct shard_conn_s *sc)
+{
+  for (uint32_t i = 1; i < shard_cnt; ++i) {
+    if (sc->clone[i].read_fd <= 0) continue;
+    epoll_ctl(shards[i].epfd, EPOLL_CTL_DEL, sc->clone[i].read_fd, NULL);
+  }
+  // a shard thread may hold an event of the clone from before the removal,
+  // and its queue datagrams that point at the clone
+  for (uint32_t i = 1; i < shard_cnt; ++i) {
+    if (sc->clone[i].read_fd <= 0) continue;
+    shard_quiesce(&shards[i]);
+    receive_fence_wait(shards[i].reader.queue, receive_fence_ticket(), shard_fence, &shards[i]);
+    close(sc->clone[i].read_fd);
+    sc->clone[i].read_fd = 0;
+  }
+  sc->origin = NULL;
+}
+
+static void busy_poll_socket(int fd)
+{
+  int usec = (int) busy_poll_usec;
+
+  // past net.core.busy_read it takes CAP_NET_ADMIN, the read loop still spins without it
+  if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) < 0) {
+    LOGW("SO_BUSY_POLL on fd %d error: %m", fd);
+  }
+}
+
+int udp_attach_connection(connection_t *c)
+{
+  struct shard_conn_s *sc = NULL;
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+  struct epoll_event ev;
+  int one = 1, fd;
+
+  if (busy_poll_usec) busy_poll_socket(c->read_fd);
+  if (shard_cnt <= 1) return OK;
+
+  pthread_mutex_lock(&shard_lock);
+  for (uint32_t i = 0; i < UDP_SHARD_CONN_MAX; ++i) {
+    if (NULL == shard_conns[i].origin) {
+      sc = &shard_conns[i];
+      break;
+    }
+  }
+  if (NULL == sc) {
+    pthread_mutex_unlock(&shard_lock);
+    LOGE("too many sharded connections");
+    return ERROR_ARG;
+  }
+  sc->origin = c;
+  memset(sc->clone, 0, sizeof(sc->clone));
+
+  // the bound socket joins the group, it becomes shard 0
+  if (getsockname(c->read_fd, (struct sockaddr *) &addr, &len) < 0
+      || setsockopt(c->read_fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+    LOGE("reuseport on fd %d error: %m", c->read_fd);
+    goto error;
+  }
+
+  for (uint32_t i = 1; i < shard_cnt; ++i) {
+    fd = socket(c->family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      LOGE("shard socket error: %m");
+      goto error;
+    }
+    sc->clone[i] = *c;
+    sc->clone[i].read_fd = fd;
+    if (busy_poll_usec) busy_poll_socket(fd);
+
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0
+        || bind(fd, (struct sockaddr *) &addr, len) < 0) {
+      LOGE("shard %d bind %s:%d error: %m", i, sockaddr_ntop(&addr), sockaddr_port(&addr));
+      goto error;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = &sc->clone[i];
+    if (epoll_ctl(shards[i].epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+      LOGE("shard %d epoll add error: %m", i);
+      goto error;
+    }
+  }
+
+  // group indexes follow the bind order, fd of shard i is member i
+  shard_steer(c->read_fd, c->family);
+
+  pthread_mutex_unlock(&shard_lock);
+
+  return OK;
+
+error:
+  shard_close(sc);
+  pthread_mutex_unlock(&shard_lock);
+  return ERROR_SOCKET;
+}
+
+int udp_detach_connection(const connection_t *c)
+{
+  if (shard_cnt <= 1) return OK;
+
+  pthread_mutex_lock(&shard_lock);
+  for (uint32_t i = 0; i < UDP_SHARD_CONN_MAX; ++i) {
+    if (c == shard_conns[i].origin) shard_close(&shard_conns[i]);
+  }
+  pthread_mutex_unlock(&shard_lock);
+
+  return OK;
+}
+
+static int shard_start(struct udp_shard_s *sh, const char *name, uint32_t size, uint32_t qlen)
+{
+  struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+
+  sh->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (sh->epfd < 0) {
+    LOGE("shard epoll create error: %m");
+    return ERROR_SOCKET;
+  }
+  sh->stop = 0;
+  sh->exited = 0;
+  if (OK != wakeup_init(&sh->wakeup) || epoll_ctl(sh->epfd, EPOLL_CTL_ADD, wakeup_fd(&sh->wakeup), &ev) < 0) {
+    LOGE("shard wakeup error: %m");
+    return ERROR_SOCKET;
+  }
+
+  sh->reader.queue = queue_create(name, size, qlen, QUEUE_BLOCK | (recv_policy ? recv_policy : QUEUE_SPSC));
+  if (NULL == sh->reader.queue) return ERROR_ARG;
+  queue_set_drop_counter(sh->reader.queue, recv_drop_counter);
+  queue_set_drop_cb(sh->reader.queue, recv_dropped, NULL);
+
+  if (OK != thread_create(&sh->thread, THREAD_ROLE_PROTOCOL, "udp shard", shard_thread, sh)) {
+    sh->thread = 0;
+    return ERROR_THREAD;
+  }
+
+  return OK;
+}
+
+/**
+ * join the shard thread, its receive thread drains the closed queue
+ */
+static void shard_stop(struct udp_shard_s *sh)
+{
+  // also gets the thread out of a reserve on a full queue
+  if (sh->reader.queue) queue_close(sh->reader.queue);
+  if (sh->thread) {
+    sh->stop = 1;
+    wakeup_signal(&sh->wakeup);
+    pthread_join(sh->thread, NULL);
+    sh->thread = 0;
+  }
+}
+
+static void shard_free(struct udp_shard_s *sh)
+{
+  shard_stop(sh);
+  // the wakeup is only set up once the epoll fd is
+  if (sh->epfd > 0) {
+    wakeup_deinit(&sh->wakeup);
+    close(sh->epfd);
+  }
+  sh->epfd = 0;
+  if (sh->reader.queue) queue_destory(sh->reader.queue);
+  sh->reader.queue = NULL;
+}
+
+#endif
+
+int udp_set_shards(uint32_t n) {
+#ifdef __linux__
+  if (n == 0 || n > UDP_SHARDS_MAX) return ERROR_ARG;
+#else
+  if (n != 1) return ERROR_ARG;
+#endif
+
+  shard_cnt = n;
+
+  return OK;
+}
+
+const queue_t *udp_get_shard_queue(uint32_t shard) {
+#ifdef __linux__
+  if (shard > 0 && shard < shard_cnt) return shards[shard].reader.queue;
+#endif
+  return shard == 0 ? main_reader.queue : NULL;
 }
 
 void *thread_cost(void *arg)
 {
-  connection_t **c;
+  connection_t *conns[UDP_EVENT_BATCH];
+  uint32_t count;
   queue_ret_t ret;
   struct thread_arg_s *cfg = (struct thread_arg_s *) arg;
 
 
   while (!exit_thread_flag) {
-    ret = queue_pop(block_queue, (void **) &c, NULL, NULL);
-    if (QUEUE_OK == ret) {
-      queue_callback_push(recv_queue, push_recv, c, NULL);
-    } else {
+    // take every ready connection with one lock
+    count = UDP_EVENT_BATCH;
+    ret = queue_pop_n(block_queue, conns, &count, NULL);
+    if (QUEUE_CLOSED == ret) break;
+    if (QUEUE_OK != ret) {
       LOGE("pop event queue %d", ret);
+      continue;
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+      recv_connection(&main_reader, conns[i]);
+    }
+    if (busy_poll_budget) busy_poll(&main_reader, conns, count, block_queue);
+
+    for (uint32_t i = 0; i < count; ++i) {
+      // the event backend owns the connection again
+      event_rearm(conns[i]);
     }
   }
   pthread_exit(NULL);
@@ -111,43 +636,92 @@ queue_t *udp_init(const queue_t *event_queue, uint32_t buf_size, uint32_t qlen)
 
   block_queue = (queue_t *) event_queue;
 
-  recv_queue = queue_create("udp main", buf_size + RECVDATA_SIZE, qlen, QUEUE_BLOCK);
+  // a drop policy needs the locked queue
+  recv_queue = queue_create("udp main", buf_size + RECVDATA_SIZE, qlen,
+                            QUEUE_BLOCK | (recv_policy ? recv_policy : QUEUE_SPSC));
   if (NULL == recv_queue) {
     return NULL;
   }
+  queue_set_drop_counter(recv_queue, recv_drop_counter);
+  queue_set_drop_cb(recv_queue, recv_dropped, NULL);
+  main_reader.queue = recv_queue;
+
+#ifdef __linux__
+  for (uint32_t i = 1; i < shard_cnt; ++i) {
+    if (OK != shard_start(&shards[i], "udp shard", buf_size + RECVDATA_SIZE, qlen)) {
+      udp_deinit();
+      return NULL;
+    }
+  }
+#endif
 
   thread_arg.buf_size = buf_size;
   thread_arg.len = qlen;
 
-  if (0 > pthread_create(&recv_thread, NULL, thread_cost, &thread_arg)) {
-    queue_destory(recv_queue);
-    LOGE("pthread create error: %m");
+  if (OK != thread_create(&recv_thread, THREAD_ROLE_PROTOCOL, "udp recv", thread_cost, &thread_arg)) {
+    recv_thread = 0;
+    udp_deinit();
     return NULL;
   }
-  pthread_detach(recv_thread);
 
   return recv_queue;
 }
 
-int udp_deinit() {
-  LOGT("udp deinit");
+int udp_stop() {
+  LOGT("udp stop");
 
+  /*
+   * Only what is queued now is drained, not what is still in the socket.
+   * The event backend pushes no more, the reader leaves its pop or its
+   * reserve on a full receive queue.
+   */
+  if (recv_queue) queue_close(recv_queue);
+  if (block_queue) queue_close(block_queue);
   if (recv_thread) {
-    pthread_cancel(recv_thread);
+    pthread_join(recv_thread, NULL);
     recv_thread = 0;
   }
 
+#ifdef __linux__
+  for (uint32_t i = 1; i < shard_cnt; ++i) {
+    shard_stop(&shards[i]);
+  }
+#endif
+
+  return OK;
+}
+
+int udp_deinit() {
+  LOGT("udp deinit");
+
+  udp_stop();
+
+#ifdef __linux__
+  for (uint32_t i = 0; i < UDP_SHARD_CONN_MAX; ++i) {
+    if (shard_conns[i].origin) shard_close(&shard_conns[i]);
+  }
+  for (uint32_t i = 1; i < shard_cnt; ++i) {
+    shard_free(&shards[i]);
+  }
+#endif
+
   if (recv_queue) {
     queue_destory(recv_queue);
     recv_queue = 0;
   }
+  main_reader.queue = NULL;
 
   return 0;
 }
 
 protocol_t protocol_udp_ = {
   .init = udp_init,
+  .stop = udp_stop,
   .deinit = udp_deinit,
 
-  .send_data = send_data
+#ifdef __linux__
+  .attach_connection = udp_attach_connection,
+  .detach_connection = udp_detach_connection,
+#endif
+  .get_queue = udp_get_shard_queue,
 };
\ No newline at end of file
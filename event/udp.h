@@ -24,12 +24,71 @@
 #include "event.h"
 #include "protocol.h"
 
+#define UDP_RECV_BATCH_MAX  64
+#define UDP_EVENT_BATCH     16
+#define UDP_SHARDS_MAX      16
+#define UDP_SHARD_CONN_MAX  16
+
 extern protocol_t protocol_udp_;
 
 queue_t *udp_init(const queue_t *event_queue, uint32_t buf_size, uint32_t qlen);
 
+/**
+ * join the reading threads and close the receive queues
+ */
+int udp_stop();
+
 int udp_deinit();
 
+/**
+ * without a socket or destination there is nothing to send to, use
+ * send_chunk() and friends of event/send.h
+ *
+ * @return ERROR_ARG
+ */
+int send_data(const void *data, size_t size);
+
+/**
+ * read up to n datagrams with one recvmmsg() per dispatch and publish them
+ * to the receive thread in one go. 1 (default) reads one datagram at a time.
+ * call it before event_init().
+ */
+int udp_set_recv_batch(uint32_t n);
+
+/**
+ * QUEUE_DROP_OLDEST or QUEUE_OVERWRITE keeps a slow consumer from blocking
+ * the socket reads. The payload bytes of a dropped datagram go to
+ * statistic.drop of the speaker it came from, and every dropped slot to
+ * drop_counter (may be NULL) for the whole socket.
+ * 0 (default) blocks. call it before event_init().
+ */
+int udp_set_recv_policy(uint32_t policy, uint32_t *drop_counter);
+
+/**
+ * Read every connection through n SO_REUSEPORT sockets on the same port,
+ * each with its own thread, queue and callback thread. Datagrams are
+ * steered by source address, one speaker always lands on the same shard
+ * and its callbacks keep their order. read_cb gets a copy of the
+ * connection whose read_fd is the shard socket. 1 (default) is off.
+ * Linux only, call it before event_init().
+ */
+int udp_set_shards(uint32_t n);
+
+/**
+ * Low latency mode, trades a core for wakeup latency: every socket gets
+ * SO_BUSY_POLL usec, and after a dispatch the connection is read again
+ * without waiting for readiness until budget reads in a row come back
+ * empty. Either can be 0 to leave it off (default). Pair it with
+ * receive_set_spin().
+ * Linux only, call it before event_init() and event_add().
+ */
+int udp_set_busy_poll(uint32_t usec, uint32_t budget);
+
 const queue_t *udp_get_queue();
 
+/**
+ * receive queue of shard, NULL past the last one
+ */
+const queue_t *udp_get_shard_queue(uint32_t shard);
+
 #endif //UDP_H
@@ -0,0 +1,720 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifdef __linux__
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "../log.h"
+#include "../common.h"
+#include "../error.h"
+#include "../thread.h"
+#include "udp.h"
+#include "uring.h"
+#include "timestamp.h"
+#include "receive.h"
+
+
+/* the low bits of user_data tell what a completion belongs to */
+#define UD_RECV     0
+#define UD_REARM    1
+#define UD_WAKEUP   2
+#define UD_CANCEL   3
+#define UD_MASK     3
+
+#define UD_PACK(ptr, tag)   ((uint64_t) (uintptr_t) (ptr) | (tag))
+#define UD_CONN(ud)         ((connection_t *) (uintptr_t) ((ud) & ~(uint64_t) UD_MASK))
+
+#define load_acquire(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+static struct {
+    int fd;
+
+    void *sq_ptr;
+    size_t sq_size;
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t *sq_mask;
+    uint32_t *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    void *cq_ptr;
+    size_t cq_size;
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    pthread_mutex_t sq_lock;
+} ring = {.fd = -1};
+
+static struct {
+    struct io_uring_buf_ring *br;
+    size_t br_size;
+    uint32_t entries;
+    uint16_t tail;
+    pthread_mutex_t lock;
+
+    uint8_t *pool;
+    uint32_t stride;
+    uint32_t head_room;
+    uint32_t buf_size;
+} bufs;
+
+static struct msghdr recv_msg = {
+  .msg_namelen = sizeof(struct sockaddr_storage),
+  .msg_controllen = TIMESTAMP_CONTROL_SIZE,
+};
+
+// what the kernel writes in front of the payload
+#define URING_HEAD_LEN  (sizeof(struct io_uring_recvmsg_out) + recv_msg.msg_namelen + recv_msg.msg_controllen)
+
+static const struct __kernel_timespec rearm_delay = {.tv_sec = 0, .tv_nsec = 1000000};
+
+// what to do once the request of a connection ended
+enum {
+    ARM_NONE,
+    ARM_NOW,
+    ARM_LATER,
+};
+
+/**
+ * The connection uring_del_connection() is taking out, one at a time: its
+ * last completion pushes a fence behind its datagrams instead of arming
+ * it again.
+ */
+static struct {
+    pthread_mutex_t del;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    const connection_t *conn;
+    uint32_t ticket;
+    int done;
+    recv_data_t fence;
+} closing = {.del = PTHREAD_MUTEX_INITIALIZER, .lock = PTHREAD_MUTEX_INITIALIZER};
+
+static pthread_once_t closing_once = PTHREAD_ONCE_INIT;
+
+static pthread_t recv_thread;
+static queue_t *recv_queue = NULL;
+static volatile int stop = 0;
+DECL_THREAD_CMD();
+
+LOG_TAG_DECLR("event");
+
+static int sys_uring_setup(uint32_t entries, struct io_uring_params *p)
+{
+  return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_uring_enter(int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags)
+{
+  return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_uring_register(int fd, uint32_t opcode, void *arg, uint32_t nr_args)
+{
+  return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/**
+ * Copy one sqe into the ring and submit it right away. Submissions are rare
+ * (arm, re-arm, cancel) so they are serialized with a mutex, completions are
+ * only reaped by the receive thread.
+ */
+static int submit(const struct io_uring_sqe *tpl)
+{
+  uint32_t tail, idx;
+  int ret;
+
+  pthread_mutex_lock(&ring.sq_lock);
+
+  tail = *ring.sq_tail;
+  if (tail - load_acquire(ring.sq_head) > *ring.sq_mask) {
+    pthread_mutex_unlock(&ring.sq_lock);
+    LOGE("uring submission queue full");
+    return ERROR_SOCKET;
+  }
+
+  idx = tail & *ring.sq_mask;
+  ring.sqes[idx] = *tpl;
+  ring.sq_array[idx] = idx;
+  store_release(ring.sq_tail, tail + 1);
+
+  do {
+    ret = sys_uring_enter(ring.fd, 1, 0, 0);
+  } while (ret < 0 && errno == EINTR);
+
+  pthread_mutex_unlock(&ring.sq_lock);
+
+  if (ret < 0) {
+    LOGE("uring submit error: %m");
+    return ERROR_SOCKET;
+  }
+
+  return OK;
+}
+
+static int arm_recv(const connection_t *c)
+{
+  struct io_uring_sqe sqe = {0};
+
+  sqe.opcode = IORING_OP_RECVMSG;
+  sqe.fd = c->read_fd;
+  sqe.addr = (uint64_t) (uintptr_t) &recv_msg;
+  sqe.ioprio = IORING_RECV_MULTISHOT;
+  sqe.flags = IOSQE_BUFFER_SELECT;
+  sqe.buf_group = URING_BUF_GROUP;
+  sqe.user_data = UD_PACK(c, UD_RECV);
+
+  return submit(&sqe);
+}
+
+static int arm_rearm_timer(const connection_t *c)
+{
+  struct io_uring_sqe sqe = {0};
+
+  sqe.opcode = IORING_OP_TIMEOUT;
+  sqe.fd = -1;
+  sqe.addr = (uint64_t) (uintptr_t) &rearm_delay;
+  sqe.len = 1;
+  sqe.user_data = UD_PACK(c, UD_REARM);
+
+  return submit(&sqe);
+}
+
+static int cancel(uint64_t user_data)
+{
+  struct io_uring_sqe sqe = {0};
+
+  sqe.opcode = IORING_OP_ASYNC_CANCEL;
+  sqe.fd = -1;
+  sqe.addr = user_data;
+  sqe.user_data = UD_PACK(NULL, UD_CANCEL);
+
+  return submit(&sqe);
+}
+
+static int arm_wakeup(int fd)
+{
+  struct io_uring_sqe sqe = {0};
+
+  sqe.opcode = IORING_OP_POLL_ADD;
+  sqe.fd = fd;
+  sqe.poll32_events = POLLIN;
+  sqe.user_data = UD_PACK(NULL, UD_WAKEUP);
+
+  return submit(&sqe);
+}
+
+static inline recv_data_t *buffer_slot(uint16_t bid)
+{
+  return (recv_data_t *) (bufs.pool + (size_t) bid * bufs.stride + bufs.head_room);
+}
+
+static void recycle(uint16_t bid)
+{
+  struct io_uring_buf *b;
+  uint8_t *data = (uint8_t *) buffer_slot(bid) + RECVDATA_SIZE;
+
+  pthread_mutex_lock(&bufs.lock);
+
+  b = &bufs.br->bufs[bufs.tail & (bufs.entries - 1)];
+  b->addr = (uint64_t) (uintptr_t) (data - URING_HEAD_LEN);
+  b->len = URING_HEAD_LEN + bufs.buf_size;
+  b->bid = bid;
+  store_release(&bufs.br->tail, ++bufs.tail);
+
+  pthread_mutex_unlock(&bufs.lock);
+}
+
+void uring_release(recv_data_t *d)
+{
+  if (NULL == d || NULL == bufs.pool) return;
+
+  recycle((uint16_t) (((uint8_t *) d - bufs.head_room - bufs.pool) / bufs.stride));
+}
+
+static void deliver(connection_t *c, uint16_t bid)
+{
+  recv_data_t *d = buffer_slot(bid);
+  uint8_t *buf = (uint8_t *) d + RECVDATA_SIZE - URING_HEAD_LEN;
+  struct io_uring_recvmsg_out out;
+  struct sockaddr_storage src;
+  uint64_t control[(TIMESTAMP_CONTROL_SIZE + 7) / 8];
+  struct msghdr msg = {.msg_control = control};
+  struct timespec stamp = {0, 0};
+  timestamp_clock_t clk = TIMESTAMP_CLOCK_NONE;
+
+  // the recvmsg header overlaps recv_data_t, copy it out before rewriting
+  memcpy(&out, buf, sizeof(out));
+  if (out.namelen > sizeof(src)) out.namelen = sizeof(src);
+  memcpy(&src, buf + sizeof(out), out.namelen);
+  if (out.controllen > sizeof(control)) out.controllen = sizeof(control);
+  if (out.controllen) {
+    memcpy(control, buf + sizeof(out) + recv_msg.msg_namelen, out.controllen);
+    msg.msg_controllen = out.controllen;
+    timestamp_parse(&msg, &stamp, &clk);
+  }
+
+  d->conn = c;
+  memcpy(&d->src, &src, out.namelen);
+  d->src_len = out.namelen;
+  d->len = out.payloadlen > bufs.buf_size ? bufs.buf_size : out.payloadlen;
+  d->stamp = stamp;
+  d->stamp_clock = clk;
+
+  if (out.flags & MSG_TRUNC) {
+    LOGW("recvmsg truncated %u > %u", out.payloadlen, bufs.buf_size);
+  }
+
+  if (QUEUE_OK != queue_normal_push(recv_queue, &d, NULL)) {
+    recycle(bid);
+  }
+}
+
+/**
+ * c has nothing in flight any more, arm it as told unless it is being
+ * removed
+ */
+static void finish(const connection_t *c, int how)
+{
+  recv_data_t *fence = &closing.fence;
+
+  pthread_mutex_lock(&closing.lock);
+
+  if (c == closing.conn) {
+    // every datagram of c was pushed by this thread, the fence goes behind them
+    receive_fence_fill(fence, closing.ticket);
+    queue_normal_push(recv_queue, &fence, NULL);
+    closing.done = 1;
+    pthread_cond_broadcast(&closing.cond);
+  } else if (ARM_NOW == how) {
+    arm_recv(c);
+  } else if (ARM_LATER == how) {
+    arm_rearm_timer(c);
+  }
+
+  pthread_mutex_unlock(&closing.lock);
+}
+
+static int recv_ended(connection_t *c, int res)
+{
+  // the multishot request is finished, only arm it again if that can help
+  switch (res) {
+    case -ENOBUFS:
+      LOGD("uring buffers exhausted, re-arm later");
+      return ARM_LATER;
+    case -ECONNREFUSED:
+      LOGW("recvmsg refused: %s", strerror(-res));
+      if (c->refuse_cb) c->refuse_cb();
+      return ARM_NOW;
+    case -EINTR:
+    case -EAGAIN:
+      return ARM_NOW;
+    case -ECANCELED:
+    case -EBADF:
+    case -ENOTSOCK:
+      return ARM_NONE;
+    default:
+      // e.g. a full completion queue ends it with the last count
+      if (res >= 0) return ARM_NOW;
+      // anything else fails again at once, the connection stops receiving
+      LOGE("recvmsg on fd %d stopped: %s", c->read_fd, strerror(-res));
+      return ARM_NONE;
+  }
+}
+
+static void complete_recv(connection_t *c, const struct io_uring_cqe *cqe)
+{
+  if (cqe->flags & IORING_CQE_F_BUFFER) {
+    deliver(c, (uint16_t) (cqe->flags >> IORING_CQE_BUFFER_SHIFT));
+  }
+
+  if (cqe->flags & IORING_CQE_F_MORE) return;
+
+  finish(c, recv_ended(c, cqe->res));
+}
+
+static void *thread_cost(void *arg)
+{
+  struct io_uring_cqe *cqe;
+  uint32_t head, tail;
+
+  while (!stop && !exit_thread_flag) {
+    if (0 > sys_uring_enter(ring.fd, 0, 1, IORING_ENTER_GETEVENTS) && errno != EINTR) {
+      LOGE("uring wait error: %m");
+      break;
+    }
+
+    head = *ring.cq_head;
+    tail = load_acquire(ring.cq_tail);
+
+    for (; head != tail; ++head) {
+      cqe = &ring.cqes[head & *ring.cq_mask];
+
+      switch (cqe->user_data & UD_MASK) {
+        case UD_RECV:
+          complete_recv(UD_CONN(cqe->user_data), cqe);
+          break;
+        case UD_REARM:
+          // cancelled only by uring_del_connection()
+          finish(UD_CONN(cqe->user_data), cqe->res == -ECANCELED ? ARM_NONE : ARM_NOW);
+          break;
+        case UD_WAKEUP:
+          wakeup_drain(&thread_cmd);
+          // POLL_ADD is one-shot
+          if (thread_cmd_exit) stop = 1;
+          else arm_wakeup(THREAD_CMD_FD());
+          break;
+        default:
+          break;
+      }
+    }
+
+    store_release(ring.cq_head, head);
+  }
+
+  pthread_exit(NULL);
+}
+
+/**
+ * Buffer rings came with 5.19, multishot recvmsg only with 6.0: arm one on
+ * a throwaway socket, an older kernel refuses it right away. Run before
+ * the completion thread starts, it reaps the ring itself.
+ */
+static int probe_multishot()
+{
+  connection_t probe = {0};
+  struct io_uring_cqe *cqe;
+  uint32_t head, tail;
+  int res = 1;
+
+  probe.read_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (0 > probe.read_fd) {
+    LOGE("uring probe socket error: %m");
+    return ERROR_SOCKET;
+  }
+
+  if (OK != arm_recv(&probe) || OK != cancel(UD_PACK(&probe, UD_RECV))) {
+    close(probe.read_fd);
+    return ERROR_SOCKET;
+  }
+
+  // the recvmsg ends either way: refused, or cancelled
+  while (res > 0) {
+    if (0 > sys_uring_enter(ring.fd, 0, 1, IORING_ENTER_GETEVENTS) && errno != EINTR) {
+      LOGE("uring probe wait error: %m");
+      res = -errno;
+      break;
+    }
+
+    head = *ring.cq_head;
+    tail = load_acquire(ring.cq_tail);
+    for (; head != tail; ++head) {
+      cqe = &ring.cqes[head & *ring.cq_mask];
+      if ((cqe->user_data & UD_MASK) == UD_RECV && !(cqe->flags & IORING_CQE_F_MORE)) res = cqe->res;
+    }
+    store_release(ring.cq_head, head);
+  }
+  close(probe.read_fd);
+
+  if (res != -ECANCELED) {
+    LOGE("uring multishot recvmsg unsupported (linux 6.0+): %s", strerror(-res));
+    return ERROR_SOCKET;
+  }
+
+  return OK;
+}
+
+static int setup_ring(uint32_t cq_entries)
+{
+  struct io_uring_params p;
+
+  memset(&p, 0, sizeof(p));
+  p.flags = IORING_SETUP_CQSIZE;
+  p.cq_entries = cq_entries;
+
+  ring.fd = sys_uring_setup(URING_SQ_ENTRIES, &p);
+  if (0 > ring.fd) {
+    LOGE("io_uring setup error: %m");
+    return ERROR_SOCKET;
+  }
+
+  ring.sq_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+  ring.cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring.cq_size > ring.sq_size) ring.sq_size = ring.cq_size;
+    ring.cq_size = ring.sq_size;
+  }
+
+  ring.sq_ptr = mmap(NULL, ring.sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd,
+                     IORING_OFF_SQ_RING);
+  if (MAP_FAILED == ring.sq_ptr) {
+    ring.sq_ptr = NULL;
+    LOGE("io_uring sq mmap error: %m");
+    return ERROR_SOCKET;
+  }
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    ring.cq_ptr = ring.sq_ptr;
+  } else {
+    ring.cq_ptr = mmap(NULL, ring.cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd,
+                       IORING_OFF_CQ_RING);
+    if (MAP_FAILED == ring.cq_ptr) {
+      ring.cq_ptr = NULL;
+      LOGE("io_uring cq mmap error: %m");
+      return ERROR_SOCKET;
+    }
+  }
+
+  ring.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd,
+                   IORING_OFF_SQES);
+  if (MAP_FAILED == ring.sqes) {
+    ring.sqes = NULL;
+    LOGE("io_uring sqes mmap error: %m");
+    return ERROR_SOCKET;
+  }
+
+  ring.sq_head = ring.sq_ptr + p.sq_off.head;
+  ring.sq_tail = ring.sq_ptr + p.sq_off.tail;
+  ring.sq_mask = ring.sq_ptr + p.sq_off.ring_mask;
+  ring.sq_array = ring.sq_ptr + p.sq_off.array;
+
+  ring.cq_head = ring.cq_ptr + p.cq_off.head;
+  ring.cq_tail = ring.cq_ptr + p.cq_off.tail;
+  ring.cq_mask = ring.cq_ptr + p.cq_off.ring_mask;
+  ring.cqes = ring.cq_ptr + p.cq_off.cqes;
+
+  pthread_mutex_init(&ring.sq_lock, NULL);
+
+  return OK;
+}
+
+static int setup_buffers(uint32_t buf_size, uint32_t count)
+{
+  struct io_uring_buf_reg reg;
+  uint32_t head_len = URING_HEAD_LEN;
+
+  bufs.entries = 1;
+  while (bufs.entries < count && bufs.entries < URING_MAX_BUFFERS) bufs.entries <<= 1;
+
+  bufs.buf_size = buf_size;
+  bufs.head_room = head_len > RECVDATA_SIZE ? head_len - RECVDATA_SIZE : 0;
+  bufs.stride = (bufs.head_room + RECVDATA_SIZE + buf_size + 63) & ~63u;
+
+  if (posix_memalign((void **) &bufs.pool, 64, (size_t) bufs.stride * bufs.entries)) {
+    bufs.pool = NULL;
+    LOGE("uring buffer pool alloc error");
+    return ERROR_SOCKET;
+  }
+
+  bufs.br_size = bufs.entries * sizeof(struct io_uring_buf);
+  bufs.br = mmap(NULL, bufs.br_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (MAP_FAILED == bufs.br) {
+    bufs.br = NULL;
+    LOGE("uring buffer ring mmap error: %m");
+    return ERROR_SOCKET;
+  }
+
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t) (uintptr_t) bufs.br;
+  reg.ring_entries = bufs.entries;
+  reg.bgid = URING_BUF_GROUP;
+  if (0 > sys_uring_register(ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1)) {
+    LOGE("uring register buffer ring error: %m");
+    return ERROR_SOCKET;
+  }
+
+  pthread_mutex_init(&bufs.lock, NULL);
+  bufs.tail = 0;
+  for (uint32_t i = 0; i < bufs.entries; ++i) {
+    recycle((uint16_t) i);
+  }
+
+  return OK;
+}
+
+int uring_add_connection(connection_t *c)
+{
+  if (0 > ring.fd) return ERROR_SOCKET;
+
+  return arm_recv(c);
+}
+
+static void closing_init()
+{
+  pthread_condattr_t attr;
+
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&closing.cond, &attr);
+  pthread_condattr_destroy(&attr);
+}
+
+int uring_del_connection(const connection_t *c)
+{
+  struct timespec deadline;
+  int done;
+
+  if (0 > ring.fd) return OK;
+
+  pthread_once(&closing_once, closing_init);
+  pthread_mutex_lock(&closing.del);
+
+  pthread_mutex_lock(&closing.lock);
+  closing.conn = c;
+  closing.ticket = receive_fence_ticket();
+  closing.done = 0;
+  pthread_mutex_unlock(&closing.lock);
+
+  // whatever is in flight ends, finish() arms nothing more for c
+  cancel(UD_PACK(c, UD_REARM));
+  cancel(UD_PACK(c, UD_RECV));
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += URING_DEL_TIMEOUT_S;
+  pthread_mutex_lock(&closing.lock);
+  while (!closing.done && recv_thread) {
+    if (ETIMEDOUT == pthread_cond_timedwait(&closing.cond, &closing.lock, &deadline)) break;
+  }
+  done = closing.done;
+  closing.conn = NULL;
+  pthread_mutex_unlock(&closing.lock);
+
+  // the queued datagrams of c are read, or handed back, before it may be freed
+  if (done) {
+    receive_fence_wait(recv_queue, closing.ticket, NULL, NULL);
+  } else if (recv_thread) {
+    LOGW("uring fd %d never completed, it was not armed", c->read_fd);
+  }
+
+  pthread_mutex_unlock(&closing.del);
+
+  return OK;
+}
+
+const queue_t *uring_get_queue()
+{
+  return recv_queue;
+}
+
+queue_t *uring_init(const queue_t *event_queue, uint32_t buf_size, uint32_t qlen)
+{
+  if (recv_queue != NULL) return recv_queue;
+
+  stop = 0;
+
+  if (OK != setup_ring(qlen * 2 > 256 ? qlen * 2 : 256)) goto error;
+  if (OK != setup_buffers(buf_size, qlen)) goto error;
+  if (OK != probe_multishot()) goto error;
+
+  // one more than the buffers and a fence, pushing a completion never blocks
+  recv_queue = queue_create_ptr("uring main", bufs.entries + 2, QUEUE_BLOCK | QUEUE_SPSC);
+  if (NULL == recv_queue) goto error;
+
+  INIT_THREAD_CMD("uring");
+  if (OK != arm_wakeup(THREAD_CMD_FD())) goto error;
+
+  if (OK != thread_create(&recv_thread, THREAD_ROLE_PROTOCOL, "uring recv", thread_cost, NULL)) {
+    recv_thread = 0;
+    goto error;
+  }
+
+  return recv_queue;
+
+error:
+  uring_deinit();
+  return NULL;
+}
+
+int uring_stop()
+{
+  LOGT("uring stop");
+
+  // completions from now on go straight back to the ring, queued buffers
+  // come back through uring_release() until deinit
+  if (recv_queue) queue_close(recv_queue);
+  if (recv_thread) {
+    stop = 1;
+    WRITE_EXIT_THREAD_CMD();
+    pthread_join(recv_thread, NULL);
+    recv_thread = 0;
+  }
+
+  return OK;
+}
+
+int uring_deinit()
+{
+  LOGT("uring deinit");
+
+  uring_stop();
+
+  DEINIT_THREAD_CMD();
+
+  if (0 <= ring.fd) {
+    close(ring.fd);
+    ring.fd = -1;
+  }
+  if (ring.sqes) munmap(ring.sqes, ring.sqes_size);
+  if (ring.cq_ptr && ring.cq_ptr != ring.sq_ptr) munmap(ring.cq_ptr, ring.cq_size);
+  if (ring.sq_ptr) munmap(ring.sq_ptr, ring.sq_size);
+  ring.sqes = NULL;
+  ring.cq_ptr = ring.sq_ptr = NULL;
+
+  if (bufs.br) {
+    munmap(bufs.br, bufs.br_size);
+    bufs.br = NULL;
+  }
+  if (bufs.pool) {
+    free(bufs.pool);
+    bufs.pool = NULL;
+  }
+
+  if (recv_queue) {
+    queue_destory(recv_queue);
+    recv_queue = NULL;
+  }
+
+  return OK;
+}
+
+protocol_t protocol_uring_ = {
+  .init = uring_init,
+  .stop = uring_stop,
+  .deinit = uring_deinit,
+
+  .add_connection = uring_add_connection,
+  .del_connection = uring_del_connection,
+  .release = uring_release,
+};
+
+#endif
@@ -0,0 +1,68 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef URING_H
+#define URING_H
+
+#include "../connection.h"
+#include "../block_queue.h"
+#include "event.h"
+#include "protocol.h"
+
+
+#define URING_SQ_ENTRIES    64
+#define URING_BUF_GROUP     0
+#define URING_MAX_BUFFERS   32768
+// uring_del_connection() gives up on a connection whose request never ends
+#define URING_DEL_TIMEOUT_S 1
+
+extern protocol_t protocol_uring_;
+
+/**
+ * Every buffer of the provided ring is a recv_data_t slot. The kernel writes
+ * io_uring_recvmsg_out, the source address and the timestamp control
+ * messages right in front of the payload, so the payload lands at
+ * RECVDATA_SIZE and only the small header is fixed up.
+ *
+ * The returned queue carries recv_data_t pointers, a slot goes back to the
+ * kernel once uring_release() is called for it.
+ */
+queue_t *uring_init(const queue_t *event_queue, uint32_t buf_size, uint32_t qlen);
+
+/**
+ * join the completion thread and close the receive queue
+ */
+int uring_stop();
+
+int uring_deinit();
+
+int uring_add_connection(connection_t *c);
+
+/**
+ * Cancel the receive of c and wait until its last completion is reaped
+ * and the receive thread is done with its queued datagrams, c may be
+ * freed once it returns. Not from a read_cb.
+ */
+int uring_del_connection(const connection_t *c);
+
+void uring_release(recv_data_t *d);
+
+const queue_t *uring_get_queue();
+
+#endif //URING_H
@@ -0,0 +1,336 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "fec.h"
+#include "../error.h"
+
+// offsets in an encoded pcm header
+#define SEQ_OFFSET  3
+#define LEN_OFFSET  9
+
+// k in the low byte, m in the high one: set by the control thread, read
+// by encoders at every group, one relaxed access so a pair is never torn
+static uint16_t ratios[SPEAKER_LINE_MAX] = {0};
+
+static inline uint16_t get_u16(const uint8_t *p)
+{
+  uint16_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline bool is_parity(const uint8_t *pack)
+{
+  return (pack[0] & 0x0F) == COMPRESS_FEC;
+}
+
+static inline void xor_bytes(uint8_t *dst, const uint8_t *src, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+    dst[i] ^= src[i];
+}
+
+int fec_set_ratio(speaker_line_t line, uint8_t k, uint8_t m)
+{
+  if (line >= SPEAKER_LINE_MAX)
+    return ERROR_ARG;
+  if (k > FEC_K_MAX || m > FEC_M_MAX || m > k || (k && !m))
+    return ERROR_ARG;
+
+  __atomic_store_n(&ratios[line], (uint16_t) (k | m << 8), __ATOMIC_RELAXED);
+
+  return OK;
+}
+
+int fec_get_ratio(speaker_line_t line, uint8_t *k, uint8_t *m)
+{
+  uint16_t r;
+
+  if (line >= SPEAKER_LINE_MAX)
+    return ERROR_ARG;
+
+  r = __atomic_load_n(&ratios[line], __ATOMIC_RELAXED);
+  *k = (uint8_t) r;
+  *m = (uint8_t) (r >> 8);
+
+  return OK;
+}
+
+void fec_encoder_init(fec_encoder_t *enc, speaker_line_t line)
+{
+  enc->line = line;
+  enc->k = enc->m = 0;
+  enc->count = 0;
+}
+
+static uint8_t *parity_payload(const fec_encoder_t *enc, int j)
+{
+  return (uint8_t *) enc->parity[j] + PCM_HEADER_SIZE_MAX;
+}
+
+static void finish_group(fec_encoder_t *enc)
+{
+  pcm_header_t hd = enc->header;
+  uint8_t *payload, *header;
+
+  hd.compress = COMPRESS_FEC;
+  hd.seq = enc->base;
+  for (int j = 0; j < enc->m; j++) {
+    payload = parity_payload(enc, j);
+    payload[0] = enc->k;
+    payload[1] = enc->m;
+    payload[2] = (uint8_t) j;
+
+    hd.len = (uint16_t) (FEC_HEADER_SIZE + enc->size[j]);
+    header = payload - PCM_HEADER_LEN(hd.ver);
+    pcm_header_encode(header, &hd);
+    pcm_header_sign(header, payload);
+  }
+}
+
+int fec_encode(fec_encoder_t *enc, const struct iovec *iov, int iovcnt)
+{
+  const uint8_t *head = (const uint8_t *) iov[0].iov_base;
+  size_t size = 0, off;
+  uint16_t seq;
+  uint8_t *parity;
+  int j;
+
+  for (int i = 0; i < iovcnt; i++)
+    size += iov[i].iov_len;
+  if (iovcnt < 1 || iov[0].iov_len < PCM_HEADER_SIZE)
+    return ERROR_ARG;
+
+  seq = get_u16(head + SEQ_OFFSET);
+  if (enc->count && seq != (uint16_t) (enc->base + enc->count))
+    enc->count = 0;
+
+  if (enc->count == 0) {
+    fec_get_ratio(enc->line, &enc->k, &enc->m);
+    if (enc->k == 0) return 0;
+
+    enc->base = seq;
+    pcm_header_decode(&enc->header, head);
+    for (j = 0; j < enc->m; j++) {
+      memset(parity_payload(enc, j) + FEC_HEADER_SIZE, 0, FEC_DATAGRAM_MAX);
+      enc->size[j] = 0;
+    }
+  }
+
+  if (size > FEC_DATAGRAM_MAX) {
+    // unprotected, and the group can not be completed
+    enc->count = 0;
+    return ERROR_ARG;
+  }
+
+  j = enc->count % enc->m;
+  parity = parity_payload(enc, j) + FEC_HEADER_SIZE;
+  off = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    xor_bytes(parity + off, iov[i].iov_base, iov[i].iov_len);
+    off += iov[i].iov_len;
+  }
+  if (size > enc->size[j])
+    enc->size[j] = (uint16_t) size;
+
+  if (++enc->count < enc->k)
+    return 0;
+
+  finish_group(enc);
+  enc->count = 0;
+
+  return enc->m;
+}
+
+int fec_parity_iov(const fec_encoder_t *enc, int j, struct iovec *iov)
+{
+  size_t header_size = PCM_HEADER_LEN(enc->header.ver);
+
+  if (j < 0 || j >= enc->m)
+    return ERROR_ARG;
+
+  iov[0].iov_base = parity_payload(enc, j) - header_size;
+  iov[0].iov_len = header_size + FEC_HEADER_SIZE + enc->size[j];
+
+  return 1;
+}
+
+/**
+ * forget the window, the next datagram starts a new stream
+ */
+static void decoder_reset(fec_decoder_t *dec)
+{
+  dec->started = false;
+  dec->last = 0;
+  for (int i = 0; i < FEC_WINDOW; i++)
+    dec->data[i].valid = false;
+  for (int i = 0; i < FEC_PARITY_SLOTS; i++)
+    dec->parity[i].valid = false;
+}
+
+void fec_decoder_init(fec_decoder_t *dec, fec_recover_cb cb, void *arg)
+{
+  dec->cb = cb;
+  dec->arg = arg;
+  dec->recovered = 0;
+  decoder_reset(dec);
+}
+
+static bool have_data(const fec_decoder_t *dec, uint16_t seq)
+{
+  return dec->data[seq % FEC_WINDOW].valid && dec->data[seq % FEC_WINDOW].seq == seq;
+}
+
+static void store_data(fec_decoder_t *dec, uint16_t seq, const void *pack, size_t size)
+{
+  fec_data_slot_t *d = &dec->data[seq % FEC_WINDOW];
+
+  d->seq = seq;
+  d->size = (uint16_t) size;
+  d->valid = true;
+  memcpy(d->data, pack, size);
+
+  if (!dec->started || (int16_t) (seq - dec->last) > 0)
+    dec->last = seq;
+  dec->started = true;
+}
+
+/**
+ * rebuild the one datagram parity p is missing, if that is all it misses
+ */
+static void try_recover(fec_decoder_t *dec, int p)
+{
+  fec_parity_slot_t *par = &dec->parity[p];
+  uint8_t buf[FEC_DATAGRAM_MAX];
+  uint16_t seq, lost = 0;
+  int missing = 0;
+  size_t size;
+
+  // the window moved on, covered datagrams may be gone
+  if ((int16_t) (dec->last - par->base) >= FEC_WINDOW) {
+    par->valid = false;
+    return;
+  }
+
+  for (int i = par->j; i < par->k; i += par->m) {
+    seq = (uint16_t) (par->base + i);
+    if (!have_data(dec, seq)) {
+      lost = seq;
+      missing++;
+    }
+  }
+  if (missing > 1) return;
+
+  par->valid = false;
+  if (missing == 0) return;
+
+  memcpy(buf, par->data, par->size);
+  for (int i = par->j; i < par->k; i += par->m) {
+    seq = (uint16_t) (par->base + i);
+    if (seq == lost) continue;
+    if (dec->data[seq % FEC_WINDOW].size > par->size) return;
+    xor_bytes(buf, dec->data[seq % FEC_WINDOW].data, dec->data[seq % FEC_WINDOW].size);
+  }
+
+  if (par->size < PCM_HEADER_SIZE || get_u16(buf + SEQ_OFFSET) != lost)
+    return;
+  size = PCM_HEADER_LEN(buf[0] >> 4) + get_u16(buf + LEN_OFFSET);
+  if (size > par->size || pcm_packet_check(buf, size, false) != OK)
+    return;
+
+  store_data(dec, lost, buf, size);
+  dec->recovered++;
+  if (dec->cb) dec->cb(buf, size, dec->arg);
+}
+
+static void try_recover_all(fec_decoder_t *dec)
+{
+  for (int i = 0; i < FEC_PARITY_SLOTS; i++)
+    if (dec->parity[i].valid)
+      try_recover(dec, i);
+}
+
+static int store_parity(fec_decoder_t *dec, const uint8_t *pack, size_t size)
+{
+  const uint8_t *payload = pack + PCM_HEADER_LEN(pack[0] >> 4);
+  uint16_t len = get_u16(pack + LEN_OFFSET), base = get_u16(pack + SEQ_OFFSET);
+  int slot = -1;
+
+  if (len < FEC_HEADER_SIZE || len - FEC_HEADER_SIZE > FEC_DATAGRAM_MAX || payload + len > pack + size)
+    return ERROR_ARG;
+  if (payload[0] > FEC_K_MAX || payload[1] == 0 || payload[1] > payload[0] || payload[2] >= payload[1])
+    return ERROR_ARG;
+
+  for (int i = 0; i < FEC_PARITY_SLOTS; i++) {
+    if (!dec->parity[i].valid) {
+      if (slot < 0) slot = i;
+      continue;
+    }
+    if (dec->parity[i].base == base && dec->parity[i].j == payload[2])
+      return 0;
+  }
+  // all in use, replace the oldest
+  if (slot < 0) {
+    slot = 0;
+    for (int i = 1; i < FEC_PARITY_SLOTS; i++)
+      if ((int16_t) (dec->parity[i].base - dec->parity[slot].base) < 0)
+        slot = i;
+  }
+
+  dec->parity[slot].base = base;
+  dec->parity[slot].k = payload[0];
+  dec->parity[slot].m = payload[1];
+  dec->parity[slot].j = payload[2];
+  dec->parity[slot].size = (uint16_t) (len - FEC_HEADER_SIZE);
+  dec->parity[slot].valid = true;
+  memcpy(dec->parity[slot].data, payload + FEC_HEADER_SIZE, len - FEC_HEADER_SIZE);
+
+  try_recover(dec, slot);
+
+  return 0;
+}
+
+int fec_decode(fec_decoder_t *dec, const void *pack, size_t size)
+{
+  const uint8_t *ptr = (const uint8_t *) pack;
+  uint16_t seq;
+
+  if (size < PCM_HEADER_SIZE)
+    return ERROR_ARG;
+
+  if (is_parity(ptr))
+    return store_parity(dec, ptr, size);
+
+  seq = get_u16(ptr + SEQ_OFFSET);
+  // a jump past the window either way is a sender restart, not a loss
+  if (dec->started && abs((int16_t) (seq - dec->last)) >= FEC_WINDOW)
+    decoder_reset(dec);
+  else if (have_data(dec, seq))
+    return 0;
+
+  if (size <= FEC_DATAGRAM_MAX) {
+    store_data(dec, seq, pack, size);
+    try_recover_all(dec);
+  }
+
+  return 1;
+}
@@ -0,0 +1,147 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef PACKAGE_FEC_H
+#define PACKAGE_FEC_H
+
+#include "pcm.h"
+#include "../speaker_struct.h"
+
+/*
+ * Forward error correction of pcm packets. After every K data packets of
+ * a stream the sender emits M parity packets, parity j is the XOR of the
+ * datagrams j, j+M, j+2M ... of the group, zero padded to the longest.
+ * The receiver rebuilds a datagram from a parity and the others it
+ * covers, so it survives a burst of up to M lost packets per group
+ * without a round trip.
+ *
+ * A parity is a pcm packet with compress COMPRESS_FEC and the seq of the
+ * first packet of its group, its samples are
+
++──────+──────+──────+──────+──────────────────────────+
+|      | k    | m    | j    | XOR of covered datagrams |
++──────+──────+──────+──────+──────────────────────────+
+| size | 8    | 8    | 8    | longest of them          |
++──────+──────+──────+──────+──────────────────────────+
+
+ */
+
+#define FEC_K_MAX           16
+#define FEC_M_MAX           4
+#define FEC_HEADER_SIZE     3
+// longest datagram (header included) that is protected
+#define FEC_DATAGRAM_MAX    1400
+// data packets the receiver remembers, parities of older ones give up
+#define FEC_WINDOW          (2 * FEC_K_MAX)
+#define FEC_PARITY_SLOTS    (2 * FEC_M_MAX)
+
+typedef struct fec_encoder_s {
+    speaker_line_t line;
+    uint8_t k, m;
+    // data packets in the group so far
+    uint8_t count;
+    uint16_t base;
+    pcm_header_t header;
+    uint16_t size[FEC_M_MAX];
+    // the parity datagrams, header right before the payload
+    uint8_t parity[FEC_M_MAX][PCM_HEADER_SIZE_MAX + FEC_HEADER_SIZE + FEC_DATAGRAM_MAX];
+} fec_encoder_t;
+
+typedef void (*fec_recover_cb)(const void *pack, size_t size, void *arg);
+
+typedef struct fec_data_slot_s {
+    uint16_t seq;
+    uint16_t size;
+    bool valid;
+    uint8_t data[FEC_DATAGRAM_MAX];
+} fec_data_slot_t;
+
+typedef struct fec_parity_slot_s {
+    uint16_t base;
+    uint16_t size;
+    uint8_t k, m, j;
+    bool valid;
+    uint8_t data[FEC_DATAGRAM_MAX];
+} fec_parity_slot_t;
+
+typedef struct fec_decoder_s {
+    fec_recover_cb cb;
+    void *arg;
+    bool started;
+    // newest seq seen
+    uint16_t last;
+    // datagrams rebuilt so far
+    uint32_t recovered;
+    fec_data_slot_t data[FEC_WINDOW];
+    fec_parity_slot_t parity[FEC_PARITY_SLOTS];
+} fec_decoder_t;
+
+/**
+ * Set the K:M ratio of line, m parity packets after every k data packets.
+ * k = 0 (default) turns it off. Encoders pick it up at their next group,
+ * it may be called from any thread.
+ *
+ * @return OK, or ERROR_ARG
+ */
+int fec_set_ratio(speaker_line_t line, uint8_t k, uint8_t m);
+
+/**
+ * @return OK, or ERROR_ARG if line is out of range
+ */
+int fec_get_ratio(speaker_line_t line, uint8_t *k, uint8_t *m);
+
+/**
+ * one encoder per stream, e.g. per line and channel
+ */
+void fec_encoder_init(fec_encoder_t *enc, speaker_line_t line);
+
+/**
+ * Add the data datagram gathered from iov (e.g. pcm_packet_iov()) to the
+ * group. The seq of consecutive packets must be consecutive, a gap starts
+ * a new group.
+ *
+ * @return number of parity packets ready, 0 while the group is not full
+ *         or the line has no fec, or ERROR_ARG if the datagram is too long
+ */
+int fec_encode(fec_encoder_t *enc, const struct iovec *iov, int iovcnt);
+
+/**
+ * point iov (one entry) at parity j, valid until the next fec_encode()
+ */
+int fec_parity_iov(const fec_encoder_t *enc, int j, struct iovec *iov);
+
+/**
+ * @param cb    called with every datagram rebuilt, like one received
+ */
+void fec_decoder_init(fec_decoder_t *dec, fec_recover_cb cb, void *arg);
+
+/**
+ * Pass every received datagram that passed pcm_packet_check(). Rebuilt
+ * datagrams are checked the same way before they go to cb.
+ *
+ * A seq FEC_WINDOW or more away from the newest, either way, is taken
+ * as the sender starting over: the window is dropped and the datagram
+ * starts a new stream.
+ *
+ * @return 1 if the caller should use the datagram, 0 if it is a parity
+ *         or a data packet already received or rebuilt, or ERROR_ARG
+ */
+int fec_decode(fec_decoder_t *dec, const void *pack, size_t size);
+
+#endif //PACKAGE_FEC_H
@@ -20,6 +20,30 @@
 #include "control.h"
 #include "detect.h"
 #include "pcm.h"
+#include "../crc.h"
+#include "../codec/adpcm.h"
+#include "../codec/lossless.h"
+#include "../error.h"
+
+// offset of pcm_header_t.len on the wire
+#define PCM_LEN_OFFSET  9
+
+// pcm header fields start at odd offsets, never load them through a cast
+static inline uint32_t get_u32(const uint8_t *p)
+{
+  uint32_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint16_t get_u16(const uint8_t *p)
+{
+  uint16_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
 
 void control_header_encode(void *pack, const control_header_t *ctl) {
   uint8_t *ptr = (uint8_t *) (pack);
@@ -193,12 +217,19 @@ void pcm_header_encode(void *pack, const pcm_header_t *hd) {
   ptr[1] = hd->sample.channel;
   ptr += 2;
 
-  ((uint16_t *) ptr)[0] = hd->seq;
+  memcpy(ptr, &hd->seq, sizeof(hd->seq));
   ptr += 2;
 
-  ((uint16_t *) ptr)[0] = hd->len;
+  memcpy(ptr, &hd->time, sizeof(hd->time));
+  ptr += 4;
+
+  memcpy(ptr, &hd->len, sizeof(hd->len));
   ptr += 2;
 
+  if (hd->ver >= PCM_VERSION_CRC) {
+    memcpy(ptr, &hd->crc, sizeof(hd->crc));
+    ptr += 4;
+  }
 }
 
 void pcm_header_decode(pcm_header_t *hd, const void *pack) {
@@ -211,13 +242,109 @@ void pcm_header_decode(pcm_header_t *hd, const void *pack) {
   hd->sample.channel = ptr[1];
   ptr += 2;
 
-  hd->seq = ((uint16_t *) ptr)[0];
+  hd->seq = get_u16(ptr);
   ptr += 2;
 
-  hd->time = ((uint32_t *) ptr)[0];
+  hd->time = get_u32(ptr);
   ptr += 4;
 
-  hd->len = ((uint16_t *) ptr)[0];
+  hd->len = get_u16(ptr);
   ptr += 2;
 
-}
\ No newline at end of file
+  hd->crc = 0;
+  if (hd->ver >= PCM_VERSION_CRC) {
+    hd->crc = get_u32(ptr);
+    ptr += 4;
+  }
+}
+
+uint32_t pcm_crc(const void *pack, const void *samples, uint16_t len) {
+  uint32_t crc = crc32c_update(0, pack, PCM_HEADER_SIZE);
+
+  return crc32c_update(crc, samples, len);
+}
+
+void pcm_header_sign(void *pack, const void *samples) {
+  uint8_t *ptr = (uint8_t *) pack;
+  uint32_t crc;
+
+  if ((ptr[0] >> 4) < PCM_VERSION_CRC) return;
+
+  crc = pcm_crc(pack, samples, get_u16(ptr + PCM_LEN_OFFSET));
+  memcpy(ptr + PCM_HEADER_SIZE, &crc, sizeof(crc));
+}
+
+int pcm_packet_check(const void *pack, size_t size, bool crc) {
+  const uint8_t *ptr = (const uint8_t *) pack;
+  size_t header_size;
+  uint16_t len;
+
+  if (size < PCM_HEADER_SIZE) return ERROR_ARG;
+
+  header_size = PCM_HEADER_LEN(ptr[0] >> 4);
+  len = get_u16(ptr + PCM_LEN_OFFSET);
+  if (size < header_size + len) return ERROR_ARG;
+
+  switch (ptr[0] & 0x0F) {
+    case COMPRESS_NONE:
+    case COMPRESS_FEC:
+      break;
+    case COMPRESS_LOSSLESS:
+      if (len < LOSSLESS_HEADER_SIZE) return ERROR_ARG;
+      break;
+    case COMPRESS_ADPCM:
+      if (len < ADPCM_HEADER_SIZE(1)) return ERROR_ARG;
+      break;
+    default:
+      // a codec this build can not decode
+      return ERROR_ARG;
+  }
+
+  if (header_size == PCM_HEADER_SIZE) return crc ? ERROR_CRC : OK;
+
+  if (get_u32(ptr + PCM_HEADER_SIZE) != pcm_crc(pack, ptr + header_size, len))
+    return ERROR_CRC;
+
+  return OK;
+}
+
+int pcm_samples_decode(void *dst, size_t size, const void *pack) {
+  const uint8_t *samples;
+  pcm_header_t hd;
+
+  pcm_header_decode(&hd, pack);
+  samples = (const uint8_t *) pack + PCM_HEADER_LEN(hd.ver);
+
+  switch (hd.compress) {
+    case COMPRESS_NONE:
+      if (size < hd.len) return ERROR_ARG;
+      memcpy(dst, samples, hd.len);
+      return hd.len;
+    case COMPRESS_LOSSLESS:
+      return lossless_decode(dst, size, samples, hd.len, hd.sample.bits);
+    case COMPRESS_ADPCM:
+      return adpcm_decode(dst, size, samples, hd.len, hd.sample.bits);
+    default:
+      return ERROR_ARG;
+  }
+}
+
+void pcm_packet_init(pcm_packet_t *p, const pcm_header_t *hd, const void *samples) {
+  pcm_header_encode(p->header, hd);
+  pcm_header_sign(p->header, samples);
+  p->header_size = PCM_HEADER_LEN(hd->ver);
+  p->len = hd->len;
+  p->samples = samples;
+}
+
+int pcm_packet_iov(const pcm_packet_t *p, struct iovec *iov) {
+  iov[0].iov_base = (void *) p->header;
+  iov[0].iov_len = p->header_size;
+
+  if (0 == p->len) return 1;
+
+  iov[1].iov_base = (void *) p->samples;
+  iov[1].iov_len = p->len;
+
+  return 2;
+}
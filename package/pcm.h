@@ -20,12 +20,30 @@
 #ifndef PACKAGE_PCM_H
 #define PACKAGE_PCM_H
 
+#if WIN32
+struct iovec {
+    void *iov_base;
+    size_t iov_len;
+};
+#else
+#include <sys/uio.h>
+#endif
 #include "../common.h"
 #include "../audio.h"
 
 
+// from PCM_VERSION_CRC on the header ends with a crc of header and samples
+#define PCM_VERSION         1
+#define PCM_VERSION_CRC     2
+
 typedef enum header_compress_s {
     COMPRESS_NONE = 0,
+    // codec/lossless.h, len is the encoded size
+    COMPRESS_LOSSLESS,
+    // codec/adpcm.h, 4:1 lossy
+    COMPRESS_ADPCM,
+    // package/fec.h parity, not samples
+    COMPRESS_FEC = 0x0F,
 } header_compress_t;
 
 typedef struct header_sample_s {
@@ -36,13 +54,13 @@ typedef struct header_sample_s {
 } header_sample_t;
 
 typedef struct channel_header_s {
-//    uint8_t crc :8;                         /* CRC 校验*/
     uint8_t ver: 4;                         /* 版本号 */
     header_compress_t compress: 4;          /* 压缩方式 */
     header_sample_t sample;                 /* pcm format */
     uint16_t seq;                           /* 序号 */
     uint32_t time;                          /* 时间 */
     uint16_t len;                           /* 长度 */
+    uint32_t crc;                           /* CRC 校验, ver >= PCM_VERSION_CRC */
 } pcm_header_t;
 
 typedef struct channel_resp_t {
@@ -54,12 +72,23 @@ typedef struct channel_resp_t {
  * @param pack
  * @param hd
 
-+──────+──────────+───────────+──────────────+─────────────+────────+────────+
-|      | version  | compress  | sample_bits  | sampe_rate  | seq    | len    |
-+──────+──────────+───────────+──────────────+─────────────+────────+────────+
-| bit  | 0-3      | 4-7       | 9-11         | 12-15       | 16-31  | 32-47  |
-| size | 4        | 4         | 4            | 4           | 16     | 16     |
-+──────+──────────+───────────+──────────────+─────────────+────────+────────+
++──────+──────────+───────────+──────────────+─────────────+──────────+────────+────────+────────+
+|      | version  | compress  | sample_bits  | sampe_rate  | channel  | seq    | time   | len    |
++──────+──────────+───────────+──────────────+─────────────+──────────+────────+────────+────────+
+| bit  | 0-3      | 4-7       | 8-11         | 12-15       | 16-23    | 24-39  | 40-71  | 72-87  |
+| size | 4        | 4         | 4            | 4           | 8        | 16     | 32     | 16     |
++──────+──────────+───────────+──────────────+─────────────+──────────+────────+────────+────────+
+
+ with version >= PCM_VERSION_CRC it is followed by
+
++──────+──────────+
+|      | crc      |
++──────+──────────+
+| bit  | 88-119   |
+| size | 32       |
++──────+──────────+
+
+ the CRC-32C of the first 11 bytes and the len bytes of samples after the header
 
  */
 void pcm_header_encode(void *pack, const pcm_header_t *hd);
@@ -68,5 +97,63 @@ void pcm_header_decode(pcm_header_t *hd, const void *pack);
 
 #define CHANNEL_HEADER_SIZE (sizeof(pcm_header_t))
 #define PCM_HEADER_SIZE    11
+#define PCM_HEADER_CRC_SIZE 4
+#define PCM_HEADER_SIZE_MAX (PCM_HEADER_SIZE + PCM_HEADER_CRC_SIZE)
+// encoded size of a header of version ver
+#define PCM_HEADER_LEN(ver) ((ver) >= PCM_VERSION_CRC ? PCM_HEADER_SIZE_MAX : PCM_HEADER_SIZE)
+
+/**
+ * crc of an encoded header and its samples, the crc field excluded
+ */
+uint32_t pcm_crc(const void *pack, const void *samples, uint16_t len);
+
+/**
+ * store pcm_crc() in the encoded header pack, if its version has the field
+ */
+void pcm_header_sign(void *pack, const void *samples);
+
+/**
+ * Check a received packet before its samples are used: size covers the
+ * header and len, compress is one this build decodes, and with
+ * PCM_VERSION_CRC the crc matches. Older versions have nothing to check
+ * but the size.
+ *
+ * @param crc   the sender was negotiated to PCM_VERSION_CRC, packets
+ *              without the field are corrupted (e.g. a flipped version)
+ * @return OK, ERROR_ARG if truncated, or ERROR_CRC if corrupted
+ */
+int pcm_packet_check(const void *pack, size_t size, bool crc);
+
+/**
+ * Decode the samples of a packet that passed pcm_packet_check() into
+ * interleaved pcm of its sample bits, whatever its compress.
+ *
+ * @return bytes written to dst, or ERROR_ARG if dst is too small, the
+ *         samples are corrupted or the packet is a parity
+ */
+int pcm_samples_decode(void *dst, size_t size, const void *pack);
+
+/**
+ * A pcm packet that is never assembled: the encoded header in its own
+ * buffer, the samples referenced where the decoder left them. It is
+ * plain data, queues copy it by value, but the samples must stay valid
+ * until the packet is sent.
+ */
+typedef struct pcm_packet_s {
+    uint8_t header[PCM_HEADER_SIZE_MAX];
+    uint8_t header_size;
+    uint16_t len;
+    const void *samples;
+} pcm_packet_t;
+
+#define PCM_PACKET_IOV_MAX  2
+
+void pcm_packet_init(pcm_packet_t *p, const pcm_header_t *hd, const void *samples);
+
+/**
+ * point iov (PCM_PACKET_IOV_MAX entries) at header and samples
+ * @return the number of entries used
+ */
+int pcm_packet_iov(const pcm_packet_t *p, struct iovec *iov);
 
 #endif //PACKAGE_PCM_H
@@ -33,6 +33,8 @@ speaker_flat_list_t speakers_list_flat = {
   .speakers = NULL
 };
 
+static void (*offline_cb)(speaker_t *sp) = NULL;
+
 LOG_TAG_DECLR("sp");
 
 void init_speakerlist(speaker_line_t line) {
@@ -75,7 +77,7 @@ speaker_t *find_speaker_by_addr(const struct sockaddr *addr, socklen_t len) {
   } else if (addr != NULL && addr->sa_family == AF_INET6) {
     for (int i = 0; i < speakers_list_flat.len; ++i) {
       s = &speakers_list_flat.speakers[i];
-      if (memcmp(&s->ip.ipv6, &((struct sockaddr_in6 *) addr)->sin6_addr, len) == 0) {
+      if (memcmp(&s->ip.ipv6, &((struct sockaddr_in6 *) addr)->sin6_addr, sizeof(struct in6_addr)) == 0) {
         return s;
       }
     }
@@ -133,21 +135,37 @@ speaker_t *find_speaker_by_id(uint32_t id) {
   return NULL;
 }
 
+static void speaker_expire(wheel_timer_t *t, void *arg) {
+  speaker_t *sp = arg;
+
+  if (!SPEAKER_IS_ONLINE(sp)) return;
+
+  SPEAKER_OFFLINE(sp);
+  LOGI("speaker(%u,%s:%d) timed out", sp->id, addr_ntop(&sp->ip), sp->dport);
+  if (offline_cb) offline_cb(sp);
+}
+
+void speaker_set_offline_cb(void (*cb)(speaker_t *sp)) {
+  offline_cb = cb;
+}
+
 void speaker_check_online(speaker_t *sp) {
   if (sp == NULL) return;
+  sp->timeout = SPEAKER_TIMEOUT;
   if (sp->dport) {
+    if (!SPEAKER_IS_ONLINE(sp)) LOGI("speaker(%u,%s:%d) is online", sp->id, addr_ntop(&sp->ip), sp->dport);
     sp->state = SPEAKER_STAT_ONLINE;
-    LOGI("speaker(%u,%s:%d) is online", sp->id, addr_ntop(&sp->ip), sp->dport);
+    timer_start(&sp->expire, sp->timeout * 1000, 0);
   } else {
     LOGI("speaker(%u,%s:%d) is offline", sp->id, addr_ntop(&sp->ip), sp->dport);
     sp->state = SPEAKER_STAT_OFFLINE;
+    timer_stop(&sp->expire);
   }
-  sp->timeout = 10;
 }
 
 void pack_list_by_ch__(speaker_list_t *list) {
   speaker_t *sp, *ns = NULL;
-  int d = 0;
+  int d = 0, pending;
   for (int i = 0, j = 0; i < list->len; ++i) {
     sp = list->speakers[i];
     if (sp == NULL || sp->state == SPEAKER_STAT_DELETED) {
@@ -163,7 +181,13 @@ void pack_list_by_ch__(speaker_list_t *list) {
         break;
       }
       if (j < list->len && ns != NULL) {
+        // a pending timer is linked by its address, it can not be copied
+        pending = timer_pending(&ns->expire);
+        timer_stop(&ns->expire);
+        if (sp != NULL) timer_stop(&sp->expire);
         *sp = *ns;
+        timer_setup(&sp->expire, speaker_expire, sp);
+        if (pending) timer_start(&sp->expire, sp->timeout * 1000, 0);
         if (sp != NULL)
           sp->idx = i;
         ns->state = SPEAKER_STAT_DELETED;
@@ -208,6 +232,8 @@ speaker_t *add_speaker(speaker_id_t id, speaker_line_t line, audio_channel_t cha
   sp->idx = speakers_list_flat.len;
   sp->state = SPEAKER_STAT_OFFLINE;
   sp->dport = 0;
+  sp->timeout = SPEAKER_TIMEOUT;
+  timer_setup(&sp->expire, speaker_expire, sp);
   sp->line = line;
   sp->channel = channel;
 
@@ -276,6 +302,9 @@ int speaker_deinit() {
   }
 
   if (speakers_list_flat.speakers) {
+    for (int i = 0; i < speakers_list_flat.len; ++i) {
+      timer_stop(&speakers_list_flat.speakers[i].expire);
+    }
     free(speakers_list_flat.speakers);
     speakers_list_flat.speakers = 0;
   }
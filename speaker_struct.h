@@ -24,6 +24,7 @@
 #include "audio.h"
 #include "ip.h"
 #include "common.h"
+#include "timer.h"
 
 
 #define DEFAULT_MULTICAST_GROUP "239.44.77.16"
@@ -36,6 +37,8 @@
 #define DEFAULT_LINE            0
 #define DEFAULT_CHANNEL         CHANNEL_FRONT_LEFT
 #define SPEAKER_GROW_STEP       10
+// seconds without hearing from a speaker before it goes offline
+#define SPEAKER_TIMEOUT         10
 
 
 typedef uint8_t speaker_line_t;
@@ -61,6 +64,7 @@ typedef struct speaker_statistic_t
     uint32_t queue; // i2s queue size(DMA size)
     uint32_t spend; // spend size for queue
     uint32_t drop;  // droped size
+    uint32_t error; // failed sends
 } speaker_statistic_t;
 
 typedef struct speaker_s {
@@ -81,6 +85,8 @@ typedef struct speaker_s {
         socket_t fd;
     };
     int timeout;
+    // takes it offline timeout seconds after it was last seen
+    wheel_timer_t expire;
     uint64_t conn_time;
     speaker_state_t state;
     speaker_statistic_t statistic;
@@ -147,8 +153,17 @@ speaker_t *find_speaker_by_ip(const addr_t *ip);
 
 speaker_t *find_speaker_by_addr(const struct sockaddr *addr, socklen_t len);
 
+/**
+ * a speaker was heard from, it goes offline on its own when it is not again
+ * within sp->timeout seconds
+ */
 void speaker_check_online(speaker_t *sp);
 
+/**
+ * told about every speaker that timed out, on the event thread
+ */
+void speaker_set_offline_cb(void (*cb)(speaker_t *sp));
+
 
 speaker_t *add_speaker(speaker_id_t id, speaker_line_t line, audio_channel_t channel);
 
@@ -0,0 +1,41 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+static int test_failures = 0;
+
+// compare as unsigned long long, report the first few failures only
+#define TEST_EQ(got, want, fmt, ...) do {                              \
+  unsigned long long got_ = (unsigned long long) (got);                \
+  unsigned long long want_ = (unsigned long long) (want);              \
+  if (got_ != want_ && test_failures++ < 20)                           \
+    printf("%s:%d: " fmt ": got 0x%llx, want 0x%llx\n",                \
+           __FILE__, __LINE__, ##__VA_ARGS__, got_, want_);            \
+} while (0)
+
+#define TEST_TRUE(cond, fmt, ...) TEST_EQ(!!(cond), 1, fmt, ##__VA_ARGS__)
+
+#define TEST_RESULT() \
+  (test_failures ? (printf("%d failures\n", test_failures), 1) : 0)
+
+#endif //TEST_H
@@ -0,0 +1,206 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <math.h>
+#include <string.h>
+#include "test.h"
+#include "codec/adpcm.h"
+#include "package/pcm.h"
+#include "error.h"
+
+#define PACKETS       20
+#define PACKET_FRAMES 480
+#define FRAMES        (PACKETS * PACKET_FRAMES)
+#define CHANNELS_MAX  8
+#define LOST          7
+
+static uint8_t pcm[FRAMES * CHANNELS_MAX * 3];
+static uint8_t out[FRAMES * CHANNELS_MAX * 3];
+static uint8_t ref[FRAMES * CHANNELS_MAX * 3];
+static uint8_t enc[PCM_HEADER_SIZE_MAX + ADPCM_SIZE(FRAMES, CHANNELS_MAX)];
+
+// a tone per channel, sweeping up so every step size is used
+static void fill(uint32_t frames, int channels, int bytes)
+{
+  uint8_t *p = pcm;
+
+  for (uint32_t i = 0; i < frames; i++) {
+    for (int c = 0; c < channels; c++, p += bytes) {
+      double f = (200.0 + 150.0 * c) * (1.0 + 4.0 * i / FRAMES);
+      int32_t v = (int32_t) (12000.0 * sin(2 * M_PI * f * i / 48000.0));
+
+      if (bytes == 3) {
+        v = v * 256 + (int32_t) (i & 0xFF);
+        *p = (uint8_t) v;
+      }
+      p[bytes - 2] = (uint8_t) (v >> (bytes * 8 - 16));
+      p[bytes - 1] = (uint8_t) (v >> (bytes * 8 - 8));
+    }
+  }
+}
+
+static int16_t upper(const uint8_t *p, int bytes)
+{
+  return (int16_t) (p[bytes - 2] | p[bytes - 1] << 8);
+}
+
+static double snr(const uint8_t *a, const uint8_t *b, size_t samples, int bytes)
+{
+  double sig = 0, err = 0, d;
+
+  for (size_t i = 0; i < samples; i++, a += bytes, b += bytes) {
+    d = upper(a, bytes) - upper(b, bytes);
+    sig += (double) upper(a, bytes) * upper(a, bytes);
+    err += d * d;
+  }
+
+  return err ? 10 * log10(sig / err) : 100;
+}
+
+static int encode(void *dst, size_t size, const void *src, uint16_t frames, int channels, audio_bits_t bits,
+                  adpcm_state_t *state)
+{
+  return adpcm_encode(dst, size, src, frames, (uint8_t) channels, bits, state);
+}
+
+static void test_round_trip(int channels, audio_bits_t bits)
+{
+  adpcm_state_t state[CHANNELS_MAX] = {0};
+  int bytes = adpcm_sample_size(bits), size, ret;
+  size_t len = (size_t) FRAMES * channels * bytes;
+  uint16_t frames;
+  uint8_t ch;
+
+  fill(FRAMES, channels, bytes);
+  size = encode(enc, sizeof(enc), pcm, FRAMES, channels, bits, state);
+  TEST_EQ(size, ADPCM_SIZE(FRAMES, channels), "encode %d channels bits %d", channels, bits);
+  TEST_EQ(adpcm_info(enc, (size_t) size, &frames, &ch), OK, "info");
+  TEST_EQ(frames, FRAMES, "info frames");
+  TEST_EQ(ch, channels, "info channels");
+
+  memset(out, 0xA5, sizeof(out));
+  ret = adpcm_decode(out, len, enc, (size_t) size, bits);
+  TEST_EQ(ret, len, "decode %d channels bits %d", channels, bits);
+  TEST_TRUE(snr(pcm, out, (size_t) FRAMES * channels, bytes) > 20, "snr %d channels bits %d: %.1f dB",
+            channels, bits, snr(pcm, out, (size_t) FRAMES * channels, bytes));
+  if (bytes == 3) TEST_EQ(out[0], 0, "24 bit low byte");
+
+  TEST_EQ(adpcm_decode(out, len, enc, (size_t) size - 1, bits), ERROR_ARG, "truncated");
+  TEST_EQ(adpcm_decode(out, len - 1, enc, (size_t) size, bits), ERROR_ARG, "short dst");
+  TEST_EQ(encode(enc, (size_t) size - 1, pcm, FRAMES, channels, bits, state), ERROR_ARG, "short enc");
+}
+
+/*
+ * packets carry the state, so each decodes on its own to what one long
+ * packet would, and a lost one costs nothing but its samples
+ */
+static void test_lost_packet(int channels)
+{
+  adpcm_state_t state[CHANNELS_MAX] = {0};
+  size_t stride = (size_t) channels * 2, packet = ADPCM_SIZE(PACKET_FRAMES, channels);
+  uint8_t pack[ADPCM_SIZE(PACKET_FRAMES, CHANNELS_MAX)];
+  int ret;
+
+  fill(FRAMES, channels, 2);
+  encode(enc, sizeof(enc), pcm, FRAMES, channels, BIT_16, state);
+  adpcm_decode(ref, sizeof(ref), enc, ADPCM_SIZE(FRAMES, channels), BIT_16);
+
+  memset(state, 0, sizeof(state));
+  memset(out, 0, sizeof(out));
+  for (int i = 0; i < PACKETS; i++) {
+    ret = encode(pack, packet, pcm + i * PACKET_FRAMES * stride, PACKET_FRAMES, channels, BIT_16, state);
+    TEST_EQ(ret, packet, "packet %d", i);
+    if (i == LOST) continue;
+    ret = adpcm_decode(out + i * PACKET_FRAMES * stride, PACKET_FRAMES * stride, pack, packet, BIT_16);
+    TEST_EQ(ret, PACKET_FRAMES * stride, "decode packet %d", i);
+  }
+
+  for (int i = 0; i < PACKETS; i++) {
+    size_t off = i * PACKET_FRAMES * stride;
+    if (i == LOST) continue;
+    TEST_TRUE(0 == memcmp(out + off, ref + off, PACKET_FRAMES * stride), "%d channels packet %d after loss",
+              channels, i);
+  }
+}
+
+// odd counts are packed nibble by nibble, coding must not depend on it
+static void test_channels_apart(int channels)
+{
+  adpcm_state_t state[CHANNELS_MAX] = {0}, one = {0};
+  static uint8_t mono[FRAMES * 2], dec[FRAMES * 2];
+  size_t stride = (size_t) channels * 2;
+
+  fill(FRAMES, channels, 2);
+  encode(enc, sizeof(enc), pcm, FRAMES, channels, BIT_16, state);
+  adpcm_decode(ref, sizeof(ref), enc, ADPCM_SIZE(FRAMES, channels), BIT_16);
+
+  for (int c = 0; c < channels; c++) {
+    memset(&one, 0, sizeof(one));
+    for (uint32_t i = 0; i < FRAMES; i++)
+      memcpy(mono + i * 2, pcm + i * stride + c * 2, 2);
+    encode(enc, sizeof(enc), mono, FRAMES, 1, BIT_16, &one);
+    adpcm_decode(dec, sizeof(dec), enc, ADPCM_SIZE(FRAMES, 1), BIT_16);
+    TEST_EQ(one.predictor, state[c].predictor, "%d channels, channel %d predictor", channels, c);
+    TEST_EQ(one.index, state[c].index, "%d channels, channel %d index", channels, c);
+    for (uint32_t i = 0; i < FRAMES; i++)
+      if (memcmp(dec + i * 2, ref + i * stride + c * 2, 2)) {
+        TEST_TRUE(0, "%d channels, channel %d frame %u", channels, c, i);
+        break;
+      }
+  }
+}
+
+int main()
+{
+  adpcm_state_t state[CHANNELS_MAX] = {0};
+  pcm_header_t hd = {0};
+  int size;
+
+  for (int ch = 1; ch <= CHANNELS_MAX; ch++) {
+    test_round_trip(ch, BIT_16);
+    test_round_trip(ch, BIT_24);
+    test_lost_packet(ch);
+    test_channels_apart(ch);
+  }
+
+  size = encode(enc, sizeof(enc), pcm, 0, 2, BIT_16, state);
+  TEST_EQ(size, ADPCM_HEADER_SIZE(2), "no frames");
+  TEST_EQ(adpcm_decode(out, 0, enc, (size_t) size, BIT_16), 0, "decode no frames");
+  TEST_EQ(encode(enc, sizeof(enc), pcm, 16, 2, BIT_32, state), ERROR_ARG, "32 bit");
+
+  // through the package layer, len is the encoded size
+  memset(state, 0, sizeof(state));
+  fill(PACKET_FRAMES, 2, 2);
+  size = encode(enc + PCM_HEADER_SIZE_MAX, sizeof(enc) - PCM_HEADER_SIZE_MAX, pcm, PACKET_FRAMES, 2, BIT_16, state);
+  hd.ver = PCM_VERSION_CRC;
+  hd.compress = COMPRESS_ADPCM;
+  hd.sample.bits = BIT_16;
+  hd.len = (uint16_t) size;
+  pcm_header_encode(enc, &hd);
+  pcm_header_sign(enc, enc + PCM_HEADER_SIZE_MAX);
+  TEST_EQ(pcm_packet_check(enc, PCM_HEADER_SIZE_MAX + (size_t) size, true), OK, "adpcm packet");
+  TEST_EQ(pcm_samples_decode(out, sizeof(out), enc), PACKET_FRAMES * 4, "adpcm packet decode");
+  TEST_TRUE(snr(pcm, out, PACKET_FRAMES * 2, 2) > 20, "adpcm packet snr");
+
+  hd.len = ADPCM_HEADER_SIZE(1) - 1;
+  pcm_header_encode(enc, &hd);
+  TEST_EQ(pcm_packet_check(enc, sizeof(enc), false), ERROR_ARG, "adpcm len below its header");
+
+  return TEST_RESULT();
+}
@@ -0,0 +1,86 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include "test.h"
+#include "ip.h"
+#include "log.h"
+
+typedef struct case_s {
+    const char *arg;
+    int want;
+} case_t;
+
+#define CASES(c) (sizeof(c) / sizeof((c)[0]))
+
+static void test_log_level_arg(void)
+{
+  static const case_t cases[] = {
+    {"xxx", -1},
+    {"", -1},
+    {"0", 0},
+    {"-1", -1},
+    {"16", 0},
+    {"trace", 0},
+    {"debug", 0},
+    {"info", 0},
+    {"warn", 0},
+    {"error", 0},
+    {"fatal", 0},
+    {"server:trace", 0},
+    {"server:0", 0},
+    {"server:-1", -1},
+    {"server:debug", 0},
+    {"server,", -1},
+    {",", -1},
+    {":", -1},
+    {"server,trace", -1},
+    {"server:", -1},
+    {":trace", -1},
+    {"server:trace,server", -1},
+    {"server:trace,server:", -1},
+    {"server:trace,server:debug", 0},
+    {"server:trace,mutex:debug", 0},
+    {"a:0,b:0,c:0,d:0,e:0,f:0", 0},
+  };
+
+  for (size_t i = 0; i < CASES(cases); i++)
+    TEST_EQ(log_set_level_from_string(cases[i].arg), cases[i].want, "level \"%s\"", cases[i].arg);
+}
+
+static void test_ip_multicast(void)
+{
+  static const case_t cases[] = {
+    {"0.0.0.0", 0},
+    {"224.0.0.0", 0},
+    {"239.0.0.1", 1},
+    {"FF01::1", 0},
+    {"FF02::1", 1},
+  };
+
+  for (size_t i = 0; i < CASES(cases); i++)
+    TEST_EQ(is_multicast_addr(cases[i].arg), cases[i].want, "multicast \"%s\"", cases[i].arg);
+}
+
+int main()
+{
+  test_log_level_arg();
+  test_ip_multicast();
+
+  return TEST_RESULT();
+}
@@ -0,0 +1,124 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <string.h>
+#include "test.h"
+#include "crc.h"
+#include "error.h"
+
+#define MAX_LEN   300
+#define MAX_OFF   16
+
+static uint8_t buf[MAX_LEN + MAX_OFF];
+
+static uint32_t ref32(uint32_t poly, const uint8_t *p, size_t len)
+{
+  uint32_t crc = 0xFFFFFFFF;
+
+  while (len--) {
+    crc ^= *p++;
+    for (int i = 0; i < 8; i++)
+      crc = (crc >> 1) ^ (crc & 1 ? poly : 0);
+  }
+
+  return ~crc;
+}
+
+static uint8_t ref8(const uint8_t *p, size_t len)
+{
+  uint8_t crc = CRC_INIT;
+
+  while (len--) {
+    crc ^= *p++;
+    for (int i = 0; i < 8; i++)
+      crc = (uint8_t) (crc & 0x80 ? (crc << 1) ^ CRC_POLY : crc << 1);
+  }
+
+  return crc;
+}
+
+static void check_impl(const char *name)
+{
+  uint32_t r32, r32c, a;
+  const uint8_t *p;
+  struct iovec iov[3];
+  size_t cut;
+
+  for (size_t off = 0; off < MAX_OFF; off++) {
+    for (size_t len = 0; len <= MAX_LEN; len++) {
+      p = buf + off;
+      r32 = ref32(CRC32_POLY, p, len);
+      r32c = ref32(CRC32C_POLY, p, len);
+
+      TEST_EQ(crc32_update(0, p, len), r32, "%s crc32 off %zu len %zu", name, off, len);
+      TEST_EQ(crc32c_update(0, p, len), r32c, "%s crc32c off %zu len %zu", name, off, len);
+
+      // incremental, split anywhere
+      cut = len * 7 / 11;
+      a = crc32_update(crc32_update(0, p, cut), p + cut, len - cut);
+      TEST_EQ(a, r32, "%s crc32 split %zu off %zu len %zu", name, cut, off, len);
+      a = crc32c_update(crc32c_update(0, p, cut), p + cut, len - cut);
+      TEST_EQ(a, r32c, "%s crc32c split %zu off %zu len %zu", name, cut, off, len);
+
+      iov[0].iov_base = (void *) p;
+      iov[0].iov_len = cut / 2;
+      iov[1].iov_base = (void *) (p + cut / 2);
+      iov[1].iov_len = cut - cut / 2;
+      iov[2].iov_base = (void *) (p + cut);
+      iov[2].iov_len = len - cut;
+      TEST_EQ(crc32_update_iov(0, iov, 3), r32, "%s crc32 iov off %zu len %zu", name, off, len);
+      TEST_EQ(crc32c_update_iov(0, iov, 3), r32c, "%s crc32c iov off %zu len %zu", name, off, len);
+    }
+  }
+}
+
+int main()
+{
+  const char *check = "123456789";
+  int simd;
+
+  for (size_t i = 0; i < sizeof(buf); i++)
+    buf[i] = (uint8_t) (i * 131 + (i >> 3) * 17 + 5);
+
+  TEST_EQ(crc32_update(0, check, 9), 0xCBF43926, "crc32 check value");
+  TEST_EQ(crc32c_update(0, check, 9), 0xE3069283, "crc32c check value");
+  TEST_EQ(crc8_check((const uint8_t *) check, 9), 0xF4, "crc8 check value");
+
+  for (size_t off = 0; off < MAX_OFF; off++) {
+    for (size_t len = 0; len <= MAX_LEN; len++) {
+      TEST_EQ(crc8_check(buf + off, (uint32_t) len), ref8(buf + off, len), "crc8 off %zu len %zu", off, len);
+    }
+  }
+
+  TEST_EQ(crc_set_impl(CRC_IMPL_TABLE), OK, "table impl");
+  check_impl("table");
+
+  simd = crc_set_impl(CRC_IMPL_SIMD);
+  if (OK == simd) {
+    check_impl(crc32_impl_name());
+  } else {
+    printf("no SIMD crc on this CPU, skipped\n");
+  }
+
+  TEST_EQ(crc_set_impl(CRC_IMPL_AUTO), OK, "auto impl");
+  check_impl("auto");
+
+  return TEST_RESULT();
+}
@@ -0,0 +1,162 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <string.h>
+#include "test.h"
+#include "package/fec.h"
+#include "error.h"
+
+#define LINE      1
+#define K         4
+#define M         1
+#define LEN       64
+
+static fec_encoder_t enc;
+static fec_decoder_t dec;
+static uint8_t pack[PCM_HEADER_SIZE_MAX + LEN];
+// seq of every datagram rebuilt
+static uint16_t rebuilt[64];
+static int rebuilt_count;
+
+static void on_recover(const void *p, size_t size, void *arg)
+{
+  pcm_header_t hd;
+  (void) arg;
+
+  TEST_EQ(size, sizeof(pack), "rebuilt size");
+  pcm_header_decode(&hd, p);
+  TEST_EQ(((const uint8_t *) p)[PCM_HEADER_SIZE_MAX], (uint8_t) hd.seq, "rebuilt samples of %u", hd.seq);
+  if (rebuilt_count < 64) rebuilt[rebuilt_count++] = hd.seq;
+}
+
+static void make(uint16_t seq)
+{
+  pcm_header_t hd = {0};
+
+  hd.ver = PCM_VERSION_CRC;
+  hd.sample.bits = BIT_16;
+  hd.seq = seq;
+  hd.len = LEN;
+  memset(pack + PCM_HEADER_SIZE_MAX, (uint8_t) seq, LEN);
+  pcm_header_encode(pack, &hd);
+  pcm_header_sign(pack, pack + PCM_HEADER_SIZE_MAX);
+}
+
+static int receive(uint16_t seq)
+{
+  make(seq);
+  return fec_decode(&dec, pack, sizeof(pack));
+}
+
+/**
+ * send seq through the encoder, delivering it unless lost, and every
+ * parity it completes
+ */
+static void transmit(uint16_t seq, bool lost)
+{
+  struct iovec iov;
+  int n;
+
+  make(seq);
+  iov.iov_base = pack;
+  iov.iov_len = sizeof(pack);
+  n = fec_encode(&enc, &iov, 1);
+  if (!lost) TEST_EQ(fec_decode(&dec, pack, sizeof(pack)), 1, "send %u", seq);
+
+  for (int j = 0; j < n; j++) {
+    fec_parity_iov(&enc, j, &iov);
+    TEST_EQ(fec_decode(&dec, iov.iov_base, iov.iov_len), 0, "parity of %u", seq);
+  }
+}
+
+static void test_ratio(void)
+{
+  uint8_t k, m;
+
+  TEST_EQ(fec_set_ratio(SPEAKER_LINE_MAX, K, M), ERROR_ARG, "set line out of range");
+  TEST_EQ(fec_get_ratio(SPEAKER_LINE_MAX, &k, &m), ERROR_ARG, "get line out of range");
+  TEST_EQ(fec_set_ratio(LINE, 2, 3), ERROR_ARG, "m above k");
+  TEST_EQ(fec_set_ratio(LINE, 2, 0), ERROR_ARG, "k without m");
+  TEST_EQ(fec_set_ratio(LINE, K, M), OK, "set");
+  TEST_EQ(fec_get_ratio(LINE, &k, &m), OK, "get");
+  TEST_EQ(k, K, "get k");
+  TEST_EQ(m, M, "get m");
+}
+
+static void test_duplicates(void)
+{
+  fec_decoder_init(&dec, on_recover, NULL);
+
+  TEST_EQ(receive(100), 1, "first");
+  TEST_EQ(receive(100), 0, "duplicate");
+  TEST_EQ(receive(102), 1, "ahead");
+  TEST_EQ(receive(101), 1, "late, in the window");
+  TEST_EQ(receive(101), 0, "late duplicate");
+  TEST_EQ(receive((uint16_t) (102 - FEC_WINDOW + 1)), 1, "oldest in the window");
+}
+
+// the sender starts over, no seq of the new stream is dropped
+static void test_reset(void)
+{
+  int used = 0;
+
+  fec_decoder_init(&dec, on_recover, NULL);
+  for (uint16_t seq = 29990; seq < 30000; seq++)
+    used += receive(seq);
+  for (uint16_t seq = 0; seq < 1000; seq++)
+    used += receive(seq);
+  TEST_EQ(used, 1010, "seq reset to 0");
+
+  // and forward, far past the window
+  TEST_EQ(receive(5000), 1, "jump ahead");
+  TEST_EQ(receive(5000), 0, "duplicate after the jump");
+  TEST_EQ(receive((uint16_t) (5000 + FEC_WINDOW)), 1, "one window ahead");
+  TEST_EQ(receive(5000), 1, "one window behind is a new stream");
+}
+
+static void test_recover(uint16_t start)
+{
+  uint16_t lost = (uint16_t) (start + K + 2);
+
+  fec_decoder_init(&dec, on_recover, NULL);
+  fec_encoder_init(&enc, LINE);
+  rebuilt_count = 0;
+
+  for (uint16_t i = 0; i < 3 * K; i++)
+    transmit((uint16_t) (start + i), (uint16_t) (start + i) == lost);
+
+  TEST_EQ(rebuilt_count, 1, "rebuilt from %u", start);
+  TEST_EQ(rebuilt[0], lost, "rebuilt seq from %u", start);
+  TEST_EQ(dec.recovered, 1, "recovered from %u", start);
+
+  // the lost one shows up after all, it was delivered already
+  TEST_EQ(receive(lost), 0, "late copy of a rebuilt datagram");
+}
+
+int main()
+{
+  test_ratio();
+  test_duplicates();
+  test_reset();
+  test_recover(1000);
+  // across the wrap of seq
+  test_recover((uint16_t) (65536 - K - 3));
+
+  return TEST_RESULT();
+}
@@ -0,0 +1,193 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "codec/lossless.h"
+#include "package/pcm.h"
+#include "error.h"
+
+#define CHANNELS  2
+
+enum {
+    SIGNAL_WALK,
+    SIGNAL_NOISE,
+    SIGNAL_CONST,
+    SIGNAL_SQUARE,
+    SIGNAL_MAX,
+};
+
+static uint8_t pcm[LOSSLESS_MAX_FRAMES * CHANNELS * 3];
+static uint8_t out[LOSSLESS_MAX_FRAMES * CHANNELS * 3];
+static uint8_t enc[PCM_HEADER_SIZE_MAX + LOSSLESS_MAX_SIZE(LOSSLESS_MAX_FRAMES, CHANNELS, 3)];
+
+static uint32_t rnd = 1;
+
+static uint32_t next_rand(void)
+{
+  rnd = rnd * 1103515245 + 12345;
+  return rnd >> 1;
+}
+
+static void fill(int signal, uint32_t frames, int bytes)
+{
+  int32_t max = bytes == 2 ? 0x7FFF : 0x7FFFFF, v[CHANNELS] = {0};
+  uint8_t *p = pcm;
+
+  for (uint32_t i = 0; i < frames; i++) {
+    for (int c = 0; c < CHANNELS; c++, p += bytes) {
+      switch (signal) {
+        case SIGNAL_WALK:
+          v[c] += (int32_t) (next_rand() % 2001) - 1000;
+          if (v[c] > max || v[c] < -max) v[c] /= 2;
+          break;
+        case SIGNAL_NOISE:
+          v[c] = (int32_t) (next_rand() % ((uint32_t) max * 2 + 2)) - max - 1;
+          break;
+        case SIGNAL_CONST:
+          v[c] = 1000;
+          break;
+        default:
+          v[c] = i & 1 ? 1000 : -1000;
+          break;
+      }
+      p[0] = (uint8_t) v[c];
+      p[1] = (uint8_t) (v[c] >> 8);
+      if (bytes == 3) p[2] = (uint8_t) (v[c] >> 16);
+    }
+  }
+}
+
+// msb first, like the encoder writes them
+static uint32_t bits_at(const uint8_t *p, size_t bit, int n)
+{
+  uint32_t v = 0;
+
+  for (int i = 0; i < n; i++, bit++)
+    v = v << 1 | ((p[bit / 8] >> (7 - bit % 8)) & 1);
+
+  return v;
+}
+
+static int round_trip(int signal, uint16_t frames, audio_bits_t bits)
+{
+  int bytes = lossless_sample_size(bits), size, ret;
+  size_t len = (size_t) frames * CHANNELS * bytes;
+  uint16_t f;
+  uint8_t ch;
+
+  fill(signal, frames, bytes);
+  size = lossless_encode(enc, LOSSLESS_MAX_SIZE(frames, CHANNELS, bytes), pcm, frames, CHANNELS, bits);
+  TEST_TRUE(size >= LOSSLESS_HEADER_SIZE, "encode signal %d frames %u bits %d: %d", signal, frames, bits, size);
+  if (size < LOSSLESS_HEADER_SIZE) return size;
+
+  TEST_EQ(lossless_info(enc, (size_t) size, &f, &ch), OK, "info frames %u", frames);
+  TEST_EQ(f, frames, "info frames");
+  TEST_EQ(ch, CHANNELS, "info channels");
+
+  memset(out, 0xA5, sizeof(out));
+  ret = lossless_decode(out, len, enc, (size_t) size, bits);
+  TEST_EQ(ret, len, "decode signal %d frames %u bits %d", signal, frames, bits);
+  TEST_TRUE(0 == memcmp(out, pcm, len), "samples signal %d frames %u bits %d", signal, frames, bits);
+
+  // one byte short is truncated, never read past
+  if (frames) {
+    ret = lossless_decode(out, len, enc, (size_t) size - 1, bits);
+    TEST_EQ(ret, ERROR_ARG, "truncated signal %d frames %u bits %d", signal, frames, bits);
+    TEST_EQ(lossless_decode(out, len - 1, enc, (size_t) size, bits), ERROR_ARG, "short dst frames %u", frames);
+  }
+
+  return size;
+}
+
+static void test_paths(audio_bits_t bits)
+{
+  int bytes = lossless_sample_size(bits), size, order;
+  size_t sub = LOSSLESS_HEADER_SIZE * 8;
+
+  // noise does not compress, every channel is stored verbatim
+  size = round_trip(SIGNAL_NOISE, 1000, bits);
+  TEST_EQ(enc[LOSSLESS_HEADER_SIZE] & 0x0F, LOSSLESS_VERBATIM, "noise is verbatim, bits %d", bits);
+  TEST_EQ(size, LOSSLESS_HEADER_SIZE + CHANNELS * (1 + 1000 * bytes), "verbatim size, bits %d", bits);
+
+  // a constant has no residual, an escape of width 0
+  round_trip(SIGNAL_CONST, 1000, bits);
+  order = enc[LOSSLESS_HEADER_SIZE] & 0x0F;
+  TEST_TRUE(order != LOSSLESS_VERBATIM, "constant is predicted, bits %d", bits);
+  sub += 8 + (size_t) order * (bytes * 8 - (enc[LOSSLESS_HEADER_SIZE] >> 4));
+  TEST_EQ(bits_at(enc, sub, 5), 31, "constant escapes, bits %d", bits);
+  TEST_EQ(bits_at(enc, sub + 5, 5), 0, "constant escape width, bits %d", bits);
+
+  // residuals of one magnitude are cheaper raw than rice coded
+  sub = LOSSLESS_HEADER_SIZE * 8;
+  round_trip(SIGNAL_SQUARE, 1000, bits);
+  TEST_EQ(enc[LOSSLESS_HEADER_SIZE] & 0x0F, 0, "square is order 0, bits %d", bits);
+  TEST_EQ(bits_at(enc, sub + 8, 5), 31, "square escapes, bits %d", bits);
+  TEST_TRUE(bits_at(enc, sub + 13, 5) > 0, "square escape width, bits %d", bits);
+}
+
+int main()
+{
+  audio_bits_t all[] = {BIT_16, BIT_24};
+  uint8_t pack[PCM_HEADER_SIZE_MAX + 16] = {0};
+  pcm_header_t hd = {0};
+  int size;
+
+  for (size_t b = 0; b < sizeof(all) / sizeof(all[0]); b++) {
+    for (uint32_t frames = 0; frames <= LOSSLESS_MAX_FRAMES; frames++)
+      round_trip(SIGNAL_WALK, (uint16_t) frames, all[b]);
+    for (int s = 0; s < SIGNAL_MAX; s++)
+      for (uint32_t frames = 0; frames <= LOSSLESS_MAX_FRAMES; frames += 97)
+        round_trip(s, (uint16_t) frames, all[b]);
+    round_trip(SIGNAL_NOISE, LOSSLESS_MAX_FRAMES, all[b]);
+    test_paths(all[b]);
+  }
+
+  TEST_EQ(lossless_encode(enc, sizeof(enc), pcm, LOSSLESS_MAX_FRAMES + 1, CHANNELS, BIT_16), ERROR_ARG,
+          "too many frames");
+  TEST_EQ(lossless_encode(enc, sizeof(enc), pcm, 16, CHANNELS, BIT_32), ERROR_ARG, "32 bit");
+
+  // through the package layer, len is the encoded size
+  size = round_trip(SIGNAL_WALK, 512, BIT_16);
+  hd.ver = PCM_VERSION_CRC;
+  hd.compress = COMPRESS_LOSSLESS;
+  hd.sample.bits = BIT_16;
+  hd.len = (uint16_t) size;
+  memmove(enc + PCM_HEADER_SIZE_MAX, enc, (size_t) size);
+  pcm_header_encode(enc, &hd);
+  pcm_header_sign(enc, enc + PCM_HEADER_SIZE_MAX);
+  TEST_EQ(pcm_packet_check(enc, PCM_HEADER_SIZE_MAX + (size_t) size, true), OK, "lossless packet");
+  memset(out, 0, sizeof(out));
+  TEST_EQ(pcm_samples_decode(out, sizeof(out), enc), 512 * CHANNELS * 2, "lossless packet decode");
+  TEST_TRUE(0 == memcmp(out, pcm, 512 * CHANNELS * 2), "lossless packet samples");
+
+  // codecs this build does not know are refused
+  hd.ver = PCM_VERSION;
+  hd.len = 8;
+  hd.compress = (header_compress_t) 0x0E;
+  pcm_header_encode(pack, &hd);
+  TEST_EQ(pcm_packet_check(pack, PCM_HEADER_SIZE + 8, false), ERROR_ARG, "unknown compress");
+  hd.compress = COMPRESS_LOSSLESS;
+  hd.len = LOSSLESS_HEADER_SIZE - 1;
+  pcm_header_encode(pack, &hd);
+  TEST_EQ(pcm_packet_check(pack, sizeof(pack), false), ERROR_ARG, "lossless len below its header");
+
+  return TEST_RESULT();
+}
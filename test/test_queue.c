@@ -0,0 +1,490 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/wait.h>
+#endif
+#include "test.h"
+#include "block_queue.h"
+#include "log.h"
+
+#define SPSC_COUNT  200000
+#define BATCH_COUNT 100000
+#define SHARED_COUNT  50000
+
+// the clock queue_pop_until() deadlines are on
+#ifdef __linux__
+#define TEST_CLOCK  CLOCK_MONOTONIC
+#else
+#define TEST_CLOCK  CLOCK_REALTIME
+#endif
+
+typedef struct elem_s {
+    uint32_t seq;
+    uint32_t check;
+} elem_t;
+
+static void *spsc_producer(void *arg)
+{
+  queue_t *q = arg;
+  elem_t e;
+
+  for (uint32_t i = 0; i < SPSC_COUNT; i++) {
+    e.seq = i;
+    e.check = ~i;
+    TEST_EQ(queue_normal_push(q, &e, NULL), QUEUE_OK, "spsc push %u", i);
+  }
+
+  return NULL;
+}
+
+static void *spsc_closer(void *arg)
+{
+  struct timespec ts = {0, 20 * 1000 * 1000};
+
+  nanosleep(&ts, NULL);
+  queue_close(arg);
+
+  return NULL;
+}
+
+/**
+ * one producer and one consumer through a ring much smaller than the
+ * stream, both sides have to sleep and wake each other
+ */
+static void test_spsc(void)
+{
+  queue_t *q = queue_create("spsc", sizeof(elem_t), 16, QUEUE_SPSC | QUEUE_BLOCK);
+  struct timespec timeout = {0, 10 * 1000 * 1000};
+  pthread_t thread;
+  elem_t *e;
+  uint32_t len;
+
+  TEST_TRUE(NULL != q, "spsc create");
+  if (NULL == q) return;
+
+  TEST_EQ(queue_pop(q, (void **) &e, NULL, &timeout), QUEUE_TIMEOUT, "spsc pop empty");
+
+  pthread_create(&thread, NULL, spsc_producer, q);
+  for (uint32_t i = 0; i < SPSC_COUNT; i++) {
+    if (QUEUE_OK != queue_pop(q, (void **) &e, &len, NULL)) {
+      TEST_TRUE(0, "spsc pop %u", i);
+      break;
+    }
+    TEST_EQ(len, sizeof(elem_t), "spsc len");
+    TEST_EQ(e->seq, i, "spsc order");
+    TEST_EQ(e->check, ~i, "spsc torn element %u", i);
+  }
+  pthread_join(thread, NULL);
+
+  // a consumer asleep on an empty queue is woken by queue_close()
+  pthread_create(&thread, NULL, spsc_closer, q);
+  TEST_EQ(queue_pop(q, (void **) &e, NULL, NULL), QUEUE_CLOSED, "spsc pop closed");
+  pthread_join(thread, NULL);
+  TEST_EQ(queue_normal_push(q, e, NULL), QUEUE_CLOSED, "spsc push closed");
+
+  queue_destory(q);
+}
+
+static void *batch_producer(void *arg)
+{
+  queue_t *q = arg;
+  uint32_t data[5], count;
+
+  for (uint32_t i = 0; i < BATCH_COUNT; i += count) {
+    count = BATCH_COUNT - i < 5 ? BATCH_COUNT - i : 5;
+    for (uint32_t k = 0; k < count; k++) data[k] = i + k;
+    // count comes back as what fit
+    if (QUEUE_OK != queue_push_n(q, data, &count, NULL)) {
+      TEST_TRUE(0, "batch push %u", i);
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+// what the drop callback was handed, in order
+static uint32_t dropped[16];
+static uint32_t dropped_count;
+
+static void on_drop(const void *data, void *arg)
+{
+  TEST_TRUE(arg == dropped, "drop arg");
+  if (dropped_count < 16) memcpy(&dropped[dropped_count++], data, sizeof(uint32_t));
+}
+
+static queue_t *drop_queue(uint32_t flag, uint32_t *counter)
+{
+  queue_t *q = queue_create("drop", sizeof(uint32_t), 4, flag);
+
+  TEST_TRUE(NULL != q, "drop create %x", flag);
+  if (NULL == q) return NULL;
+
+  *counter = 0;
+  dropped_count = 0;
+  queue_set_drop_counter(q, counter);
+  queue_set_drop_cb(q, on_drop, dropped);
+
+  return q;
+}
+
+/**
+ * push v0..v0+n-1 one by one, every push has to succeed
+ */
+static void push_seq(queue_t *q, uint32_t v0, uint32_t n)
+{
+  for (uint32_t v = v0; v < v0 + n; v++) TEST_EQ(queue_normal_push(q, &v, NULL), QUEUE_OK, "push %u", v);
+}
+
+static void expect(queue_t *q, const uint32_t *want, uint32_t n, const char *what)
+{
+  uint32_t data[8], count = 8;
+
+  TEST_EQ(queue_pop_n(q, data, &count, NULL), n ? QUEUE_OK : QUEUE_EMPTY, "%s pop", what);
+  TEST_EQ(count, n ? n : 8, "%s left", what);
+  for (uint32_t i = 0; i < n && i < count; i++) TEST_EQ(data[i], want[i], "%s left %u", what, i);
+}
+
+static void expect_dropped(const uint32_t *want, uint32_t n, const char *what)
+{
+  TEST_EQ(dropped_count, n, "%s dropped", what);
+  for (uint32_t i = 0; i < n && i < dropped_count; i++) TEST_EQ(dropped[i], want[i], "%s dropped %u", what, i);
+}
+
+/**
+ * a full queue with a drop policy never refuses the producer: the oldest
+ * or the newest element goes, unless the consumer holds it, and every
+ * drop is counted and handed to the drop callback
+ */
+static void test_drop(void)
+{
+  uint32_t counter, *slot, count, v;
+  queue_t *q;
+
+  if (NULL == (q = drop_queue(QUEUE_DROP_OLDEST, &counter))) return;
+  push_seq(q, 0, 6);
+  expect(q, (uint32_t[]) {3, 4, 5}, 3, "oldest");
+  expect_dropped((uint32_t[]) {0, 1, 2}, 3, "oldest");
+  TEST_EQ(counter, 3 * sizeof(uint32_t), "oldest counter");
+  TEST_EQ(q->dropped, 3, "oldest dropped");
+
+  // push_n keeps the newest of what does not fit
+  dropped_count = 0;
+  count = 5;
+  TEST_EQ(queue_push_n(q, (uint32_t[]) {10, 11, 12, 13, 14}, &count, NULL), QUEUE_OK, "oldest push_n");
+  TEST_EQ(count, 5, "oldest push_n count");
+  expect(q, (uint32_t[]) {12, 13, 14}, 3, "oldest push_n");
+  expect_dropped((uint32_t[]) {10, 11}, 2, "oldest push_n");
+  queue_destory(q);
+
+  if (NULL == (q = drop_queue(QUEUE_OVERWRITE, &counter))) return;
+  push_seq(q, 0, 6);
+  expect(q, (uint32_t[]) {0, 1, 5}, 3, "overwrite");
+  expect_dropped((uint32_t[]) {2, 3, 4}, 3, "overwrite");
+  TEST_EQ(counter, 3 * sizeof(uint32_t), "overwrite counter");
+  queue_destory(q);
+
+  // peeked elements belong to the consumer, the incoming one goes instead
+  if (NULL == (q = drop_queue(QUEUE_DROP_OLDEST, &counter))) return;
+  push_seq(q, 0, 3);
+  count = 1;
+  queue_peek(q, (void **) &slot, &count, NULL);
+  v = 3;
+  TEST_EQ(queue_normal_push(q, &v, NULL), QUEUE_FULL, "held push");
+  TEST_EQ(slot[0], 0, "held element");
+
+  // a reservation on a full queue gets the spare slot, dropped on commit
+  count = 1;
+  TEST_EQ(queue_reserve(q, (void **) &slot, &count, NULL), QUEUE_OK, "held reserve");
+  *slot = 4;
+  queue_commit(q, 1);
+  expect_dropped((uint32_t[]) {3, 4}, 2, "held");
+  TEST_EQ(counter, 2 * sizeof(uint32_t), "held counter");
+
+  queue_release(q, 1);
+  expect(q, (uint32_t[]) {1, 2}, 2, "held");
+  queue_destory(q);
+}
+
+#ifdef __linux__
+/**
+ * a child process attaches the memfd and produces, the parent peeks the
+ * elements in place from its own mapping
+ */
+static void test_shared(uint32_t flag)
+{
+  int fd = -1, status = -1;
+  queue_t *q = queue_create_shared("shared", sizeof(elem_t), 16, QUEUE_BLOCK | flag, &fd);
+  uint32_t next = 0, count;
+  elem_t *e;
+  pid_t pid;
+
+  TEST_TRUE(NULL != q, "shared create %x", flag);
+  if (NULL == q) return;
+  TEST_EQ(queue_set_drop_cb(q, on_drop, NULL), QUEUE_PARAM_ERROR, "shared drop cb %x", flag);
+
+  pid = fork();
+  if (0 == pid) {
+    queue_t *child = queue_attach_shared(fd);
+    elem_t v;
+
+    if (NULL == child) _exit(2);
+    for (uint32_t i = 0; i < SHARED_COUNT; i++) {
+      v.seq = i;
+      v.check = ~i;
+      if (QUEUE_OK != queue_normal_push(child, &v, NULL)) _exit(3);
+    }
+    queue_destory(child);
+    _exit(0);
+  }
+  TEST_TRUE(pid > 0, "shared fork %x", flag);
+
+  while (pid > 0 && next < SHARED_COUNT) {
+    count = 0;
+    if (QUEUE_OK != queue_peek(q, (void **) &e, &count, NULL)) {
+      TEST_TRUE(0, "shared peek %u", next);
+      break;
+    }
+    for (uint32_t i = 0; i < count; i++, next++) {
+      TEST_EQ(e[i].seq, next, "shared order %x", flag);
+      TEST_EQ(e[i].check, ~next, "shared torn element %u", next);
+    }
+    queue_release(q, count);
+  }
+  if (pid > 0) waitpid(pid, &status, 0);
+  TEST_TRUE(WIFEXITED(status) && 0 == WEXITSTATUS(status), "shared producer exit 0x%x", status);
+
+  queue_destory(q);
+  close(fd);
+}
+#endif
+
+static int64_t now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(TEST_CLOCK, &ts);
+  return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static struct timespec *after_ms(struct timespec *ts, int64_t ms)
+{
+  int64_t at = now_ms() + ms;
+
+  ts->tv_sec = at / 1000;
+  ts->tv_nsec = (at % 1000) * 1000000;
+  return ts;
+}
+
+static void *deadline_producer(void *arg)
+{
+  struct timespec ts = {0, 20 * 1000 * 1000};
+  uint32_t v = 42;
+
+  nanosleep(&ts, NULL);
+  queue_normal_push(arg, &v, NULL);
+
+  return NULL;
+}
+
+/**
+ * queue_pop_until() gives up at its absolute deadline, not before, and
+ * not at all if an element arrives first, a full push times out alike
+ */
+static void test_deadline(uint32_t flag)
+{
+  queue_t *q = queue_create("deadline", sizeof(uint32_t), 2, QUEUE_BLOCK | flag);
+  struct timespec deadline, timeout = {0, 30 * 1000 * 1000};
+  pthread_t thread;
+  uint32_t *e, v = 1;
+  int64_t start;
+
+  TEST_TRUE(NULL != q, "deadline create %x", flag);
+  if (NULL == q) return;
+
+  start = now_ms();
+  TEST_EQ(queue_pop_until(q, (void **) &e, NULL, after_ms(&deadline, -10)), QUEUE_TIMEOUT, "past deadline %x", flag);
+  TEST_TRUE(now_ms() - start < 20, "past deadline waited %x", flag);
+
+  start = now_ms();
+  TEST_EQ(queue_pop_until(q, (void **) &e, NULL, after_ms(&deadline, 50)), QUEUE_TIMEOUT, "deadline %x", flag);
+  TEST_TRUE(now_ms() - start >= 49, "deadline early %x", flag);
+  TEST_TRUE(now_ms() - start < 1000, "deadline late %x", flag);
+
+  pthread_create(&thread, NULL, deadline_producer, q);
+  TEST_EQ(queue_pop_until(q, (void **) &e, NULL, after_ms(&deadline, 5000)), QUEUE_OK, "pop before deadline %x", flag);
+  TEST_EQ(*e, 42, "pop before deadline %x", flag);
+  pthread_join(thread, NULL);
+
+  // one usable slot
+  TEST_EQ(queue_normal_push(q, &v, &timeout), QUEUE_OK, "push %x", flag);
+  start = now_ms();
+  TEST_EQ(queue_normal_push(q, &v, &timeout), QUEUE_TIMEOUT, "push full %x", flag);
+  TEST_TRUE(now_ms() - start >= 29, "push timeout early %x", flag);
+
+  queue_destory(q);
+}
+
+/**
+ * push_n and pop_n take what fits, wrap around the end of the ring, and
+ * keep order between a producer and a consumer thread
+ */
+static void test_batch(uint32_t flag)
+{
+  queue_t *q = queue_create("batch", sizeof(uint32_t), 8, flag);
+  uint32_t data[16], count, next = 0;
+  pthread_t thread;
+
+  TEST_TRUE(NULL != q, "batch create %x", flag);
+  if (NULL == q) return;
+
+  for (uint32_t i = 0; i < 16; i++) data[i] = i;
+  count = 10;
+  TEST_EQ(queue_push_n(q, data, &count, NULL), QUEUE_OK, "push_n %x", flag);
+  TEST_EQ(count, 7, "push_n what fits %x", flag);
+  count = 1;
+  TEST_EQ(queue_push_n(q, data, &count, NULL), QUEUE_FULL, "push_n full %x", flag);
+
+  count = 3;
+  TEST_EQ(queue_pop_n(q, data, &count, NULL), QUEUE_OK, "pop_n %x", flag);
+  TEST_EQ(count, 3, "pop_n count %x", flag);
+  for (uint32_t i = 0; i < count; i++) TEST_EQ(data[i], i, "pop_n %x", flag);
+
+  for (uint32_t i = 0; i < 5; i++) data[i] = 10 + i;
+  count = 5;
+  queue_push_n(q, data, &count, NULL);
+  TEST_EQ(count, 3, "push_n wrapped %x", flag);
+
+  count = 16;
+  TEST_EQ(queue_pop_n(q, data, &count, NULL), QUEUE_OK, "pop_n wrapped %x", flag);
+  TEST_EQ(count, 7, "pop_n all %x", flag);
+  for (uint32_t i = 0; i < count; i++) TEST_EQ(data[i], i < 4 ? 3 + i : 6 + i, "pop_n wrapped %x", flag);
+  count = 16;
+  TEST_EQ(queue_pop_n(q, data, &count, NULL), QUEUE_EMPTY, "pop_n empty %x", flag);
+  queue_destory(q);
+
+  q = queue_create("batch", sizeof(uint32_t), 8, QUEUE_BLOCK | flag);
+  if (NULL == q) return;
+  pthread_create(&thread, NULL, batch_producer, q);
+  while (next < BATCH_COUNT) {
+    count = 4;
+    if (QUEUE_OK != queue_pop_n(q, data, &count, NULL)) {
+      TEST_TRUE(0, "batch pop %u", next);
+      break;
+    }
+    for (uint32_t i = 0; i < count; i++, next++) TEST_EQ(data[i], next, "batch order %x", flag);
+  }
+  pthread_join(thread, NULL);
+
+  queue_destory(q);
+}
+
+/**
+ * reserve, fill and commit in place, then peek and release in place,
+ * across the end of the ring
+ */
+static void test_reserve_peek(uint32_t flag)
+{
+  queue_t *q = queue_create("zerocopy", sizeof(uint32_t), 8, QUEUE_BLOCK | flag);
+  struct timespec timeout = {0, 10 * 1000 * 1000};
+  uint32_t *slot, *first, count;
+
+  TEST_TRUE(NULL != q, "zerocopy create %x", flag);
+  if (NULL == q) return;
+
+  // 7 usable slots, all contiguous while empty
+  count = 0;
+  TEST_EQ(queue_reserve(q, (void **) &first, &count, NULL), QUEUE_OK, "reserve %x", flag);
+  TEST_EQ(count, 7, "reserve all %x", flag);
+  for (uint32_t i = 0; i < 5; i++) first[i] = i;
+  TEST_EQ(queue_commit(q, 5), QUEUE_OK, "commit %x", flag);
+
+  count = 0;
+  TEST_EQ(queue_peek(q, (void **) &slot, &count, NULL), QUEUE_OK, "peek %x", flag);
+  TEST_EQ(count, 5, "peek all %x", flag);
+  TEST_TRUE(slot == first, "peek in place %x", flag);
+  for (uint32_t i = 0; i < count; i++) TEST_EQ(slot[i], i, "peek %x", flag);
+  TEST_EQ(queue_release(q, 2), QUEUE_OK, "release %x", flag);
+
+  // only up to the end of the ring, then the rest from its start
+  count = 0;
+  queue_reserve(q, (void **) &slot, &count, NULL);
+  TEST_EQ(count, 3, "reserve to the end %x", flag);
+  TEST_TRUE(slot == first + 5, "reserve after the committed %x", flag);
+  for (uint32_t i = 0; i < count; i++) slot[i] = 5 + i;
+  queue_commit(q, count);
+
+  count = 4;
+  queue_reserve(q, (void **) &slot, &count, NULL);
+  TEST_EQ(count, 1, "reserve wrapped %x", flag);
+  TEST_TRUE(slot == first, "reserve from the start %x", flag);
+  slot[0] = 8;
+  // an unused reservation publishes nothing
+  queue_commit(q, 0);
+  count = 1;
+  queue_reserve(q, (void **) &slot, &count, NULL);
+  TEST_TRUE(slot == first, "reserve again %x", flag);
+  slot[0] = 8;
+  queue_commit(q, 1);
+
+  count = 2;
+  queue_peek(q, (void **) &slot, &count, NULL);
+  TEST_EQ(count, 2, "peek some %x", flag);
+  TEST_EQ(slot[0], 2, "peek after release %x", flag);
+  queue_release(q, 2);
+
+  count = 0;
+  queue_peek(q, (void **) &slot, &count, NULL);
+  TEST_EQ(count, 4, "peek to the end %x", flag);
+  for (uint32_t i = 0; i < count; i++) TEST_EQ(slot[i], 4 + i, "peek %x", flag);
+  queue_release(q, count);
+
+  count = 0;
+  queue_peek(q, (void **) &slot, &count, NULL);
+  TEST_EQ(count, 1, "peek wrapped %x", flag);
+  TEST_EQ(slot[0], 8, "peek wrapped %x", flag);
+  queue_release(q, count);
+
+  TEST_EQ(queue_peek(q, (void **) &slot, &count, &timeout), QUEUE_TIMEOUT, "peek empty %x", flag);
+
+  queue_destory(q);
+}
+
+int main()
+{
+  log_set_level(LOG_WARN);
+
+  test_spsc();
+  test_reserve_peek(0);
+  test_reserve_peek(QUEUE_SPSC);
+  test_batch(0);
+  test_batch(QUEUE_SPSC);
+  test_deadline(0);
+  test_deadline(QUEUE_SPSC);
+  test_drop();
+#ifdef __linux__
+  test_shared(0);
+  test_shared(QUEUE_SPSC);
+#endif
+
+  return TEST_RESULT();
+}
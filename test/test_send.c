@@ -0,0 +1,240 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#include <arpa/inet.h>
+#include "test.h"
+#include "event/send.h"
+#include "error.h"
+#include "log.h"
+
+// loopback receivers, one per speaker unless it says otherwise
+#define RECEIVERS   3
+// more speakers than one sendmmsg() takes
+#define CROWD       (SEND_BATCH_MAX * 2 + 10)
+// more segments than one UDP_SEGMENT message takes, the last one short
+#define SEG_SIZE    100
+#define SEG_COUNT   (SEND_GSO_MAX_SEGMENTS * 2 + 3)
+#define SEG_LAST    40
+
+static int receivers[RECEIVERS];
+static speaker_t speakers[CROWD];
+static speaker_t *slots[CROWD + 4];
+static speaker_list_t list = {.max = CROWD + 4, .speakers = slots};
+
+static int receiver(uint16_t *port)
+{
+  struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+  socklen_t len = sizeof(addr);
+  int fd = socket(AF_INET, SOCK_DGRAM, 0), size = 1 << 22;
+
+  bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+  getsockname(fd, (struct sockaddr *) &addr, &len);
+  // room for every datagram of a test, nothing reads until it is sent
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  *port = ntohs(addr.sin_port);
+
+  return fd;
+}
+
+static speaker_t *speaker_at(uint32_t i, int fd_index)
+{
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  speaker_t *sp = &speakers[i];
+
+  memset(sp, 0, sizeof(*sp));
+  sp->id = i;
+  sp->ip.type = AF_INET;
+  sp->ip.ipv4.s_addr = htonl(INADDR_LOOPBACK);
+  getsockname(receivers[fd_index], (struct sockaddr *) &addr, &len);
+  sp->dport = ntohs(addr.sin_port);
+  SPEAKER_ONLINE(sp);
+
+  return sp;
+}
+
+/**
+ * datagrams waiting on a receiver, each compared with want if not NULL
+ */
+static int drain(int fd, const void *want, size_t size)
+{
+  uint8_t buf[2048];
+  ssize_t n;
+  int count = 0;
+
+  while ((n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) >= 0) {
+    if (want) {
+      TEST_EQ(n, size, "received size");
+      TEST_TRUE(0 == memcmp(buf, want, size), "received payload");
+    }
+    count++;
+  }
+
+  return count;
+}
+
+#ifdef __linux__
+// make the device refuse segmentation, as one that can not checksum segments
+static int refuse_gso = 0;
+
+// in front of the libc one, send.c links against this
+int sendmmsg(int fd, struct mmsghdr *msgs, unsigned int n, int flags)
+{
+  if (refuse_gso && NULL != msgs[0].msg_hdr.msg_control) {
+    errno = EIO;
+    return -1;
+  }
+
+  return (int) syscall(SYS_sendmmsg, fd, msgs, n, flags);
+}
+#endif
+
+/**
+ * every speaker gets the datagrams of the chunk in order, whole segments
+ * then the short last one
+ */
+static void expect_segments(int fd, const uint8_t *data, const char *what)
+{
+  uint8_t buf[2048];
+  ssize_t n;
+  int count = 0;
+
+  while ((n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) >= 0) {
+    size_t size = count < SEG_COUNT - 1 ? SEG_SIZE : SEG_LAST;
+
+    TEST_EQ(n, size, "%s size of %d", what, count);
+    TEST_TRUE(n == (ssize_t) size && 0 == memcmp(buf, data + count * SEG_SIZE, size), "%s payload of %d", what, count);
+    count++;
+  }
+  TEST_EQ(count, SEG_COUNT, "%s datagrams", what);
+}
+
+/**
+ * send_segments() delivers a chunk as seg_size datagrams, with UDP_SEGMENT
+ * where the kernel has it, per datagram where it does not, and again per
+ * datagram once the device refused it
+ */
+static void test_segments(int fd)
+{
+  static uint8_t data[(SEG_COUNT - 1) * SEG_SIZE + SEG_LAST];
+  const size_t size = sizeof(data);
+  int n;
+
+  for (size_t i = 0; i < size; i++) data[i] = (uint8_t) (i / SEG_SIZE * 7 + i);
+
+  list.len = 0;
+  for (int i = 0; i < RECEIVERS; i++) slots[list.len++] = speaker_at(i, i);
+
+  n = send_segments(fd, data, size, SEG_SIZE, &list);
+  TEST_EQ(n, SEG_COUNT * RECEIVERS, "segments sent");
+  for (int i = 0; i < RECEIVERS; i++) expect_segments(receivers[i], data, "segments");
+
+  // no larger than a segment, one plain datagram
+  n = send_segments(fd, data, SEG_SIZE, SEG_SIZE, &list);
+  TEST_EQ(n, RECEIVERS, "one segment sent");
+  for (int i = 0; i < RECEIVERS; i++) TEST_EQ(drain(receivers[i], data, SEG_SIZE), 1, "one segment");
+
+  TEST_EQ(send_segments(fd, data, size, 0, &list), ERROR_ARG, "no segment size");
+
+#ifdef __linux__
+  refuse_gso = 1;
+  n = send_segments(fd, data, size, SEG_SIZE, &list);
+  TEST_EQ(n, SEG_COUNT * RECEIVERS, "refused segments sent");
+  for (int i = 0; i < RECEIVERS; i++) expect_segments(receivers[i], data, "refused segments");
+  for (int i = 0; i < RECEIVERS; i++) TEST_EQ(speakers[i].statistic.error, 0, "refused error of %d", i);
+  refuse_gso = 0;
+#endif
+}
+
+/**
+ * every online speaker with a port gets the chunk once, holes, offline and
+ * portless entries are skipped, a destination the socket can not reach
+ * counts in its own statistic.error without stopping the others
+ */
+static void test_fan_out(int fd)
+{
+  static const char hello[] = "hello";
+  struct iovec iov[3] = {{"he", 2}, {"ll", 2}, {"o", 2}};
+  speaker_t *sp;
+  uint16_t port;
+  int n;
+
+  for (int i = 0; i < RECEIVERS; i++) receivers[i] = receiver(&port);
+
+  list.len = 0;
+  for (int i = 0; i < RECEIVERS; i++) slots[list.len++] = speaker_at(i, i);
+  // a hole left by change_channel()
+  slots[list.len++] = NULL;
+  sp = slots[list.len++] = speaker_at(RECEIVERS, 0);
+  SPEAKER_OFFLINE(sp);
+  sp = slots[list.len++] = speaker_at(RECEIVERS + 1, 0);
+  sp->dport = 0;
+  // an IPv6 speaker is unreachable from an IPv4 socket
+  sp = slots[list.len++] = speaker_at(RECEIVERS + 2, 0);
+  sp->ip.type = AF_INET6;
+  sp->ip.ipv6 = in6addr_loopback;
+
+  n = send_chunk(fd, hello, sizeof(hello), &list);
+  TEST_EQ(n, RECEIVERS, "send_chunk speakers");
+  for (int i = 0; i < RECEIVERS; i++) TEST_EQ(drain(receivers[i], hello, sizeof(hello)), 1, "send_chunk to %d", i);
+  TEST_EQ(speakers[RECEIVERS + 2].statistic.error, 1, "unreachable error");
+  for (int i = 0; i < RECEIVERS + 2; i++) TEST_EQ(speakers[i].statistic.error, 0, "error of %d", i);
+
+  // the pieces arrive as one datagram
+  n = send_iov(fd, iov, 3, &list);
+  TEST_EQ(n, RECEIVERS, "send_iov speakers");
+  for (int i = 0; i < RECEIVERS; i++) TEST_EQ(drain(receivers[i], hello, sizeof(hello)), 1, "send_iov to %d", i);
+
+  // several sendmmsg() batches
+  list.len = 0;
+  for (int i = 0; i < CROWD; i++) slots[list.len++] = speaker_at(i, i % RECEIVERS);
+  n = send_chunk(fd, hello, sizeof(hello), &list);
+  TEST_EQ(n, CROWD, "crowd speakers");
+  n = 0;
+  for (int i = 0; i < RECEIVERS; i++) n += drain(receivers[i], hello, sizeof(hello));
+  TEST_EQ(n, CROWD, "crowd received");
+
+  TEST_EQ(send_chunk(fd, hello, sizeof(hello), NULL), ERROR_ARG, "no list");
+  TEST_EQ(send_iov(fd, iov, 0, &list), ERROR_ARG, "no pieces");
+}
+
+int main()
+{
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+  log_set_level(LOG_WARN);
+
+  test_fan_out(fd);
+  test_segments(fd);
+
+  close(fd);
+  for (int i = 0; i < RECEIVERS; i++) close(receivers[i]);
+
+  return TEST_RESULT();
+}
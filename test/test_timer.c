@@ -0,0 +1,176 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <time.h>
+#include <poll.h>
+#include "test.h"
+#include "timer.h"
+#include "error.h"
+#include "log.h"
+
+#define TICK_MS     1
+#define MANY        1000
+// a loaded machine may run a tick late, never early
+#define LATE_MS     50
+
+typedef struct shot_s {
+    wheel_timer_t timer;
+    uint32_t ms;
+    int64_t at;
+    int fired;
+    // stop itself after this many runs, 0 never
+    int stop_after;
+} shot_t;
+
+static int64_t start_ms;
+
+static int64_t now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void on_shot(wheel_timer_t *t, void *arg)
+{
+  shot_t *s = arg;
+
+  TEST_TRUE(t == &s->timer, "callback timer");
+  if (0 == s->fired++) s->at = now_ms() - start_ms;
+  if (s->stop_after && s->fired == s->stop_after) timer_stop(t);
+}
+
+static void shot(shot_t *s, uint32_t ms, uint32_t period_ms)
+{
+  s->ms = ms;
+  s->fired = 0;
+  s->at = -1;
+  timer_setup(&s->timer, on_shot, s);
+  TEST_EQ(timer_start(&s->timer, ms, period_ms), OK, "start %u", ms);
+}
+
+/**
+ * what the event loop does: wait for the timerfd, or a tick without one
+ */
+static void run_for(uint32_t ms)
+{
+  int64_t end = now_ms() + ms;
+  struct pollfd pfd = {.fd = timer_fd(), .events = POLLIN};
+  struct timespec tick = {0, TICK_MS * 1000 * 1000};
+
+  while (now_ms() < end) {
+    if (pfd.fd >= 0) poll(&pfd, 1, TICK_MS);
+    else nanosleep(&tick, NULL);
+    timer_process();
+  }
+}
+
+/**
+ * one shots fire once, never before their time, whichever level of the
+ * wheel they start on
+ */
+static void test_once(void)
+{
+  static const uint32_t delays[] = {0, 1, 5, 63, 64, 65, 130, 300};
+  shot_t shots[sizeof(delays) / sizeof(delays[0])];
+  const size_t n = sizeof(delays) / sizeof(delays[0]);
+
+  start_ms = now_ms();
+  for (size_t i = 0; i < n; i++) shot(&shots[i], delays[i], 0);
+  TEST_TRUE(timer_fd() < 0 || timer_next_ms() == TICK_MS, "ticking while pending");
+  run_for(300 + LATE_MS * 2);
+
+  for (size_t i = 0; i < n; i++) {
+    TEST_EQ(shots[i].fired, 1, "once %u", delays[i]);
+    TEST_TRUE(shots[i].at >= delays[i], "once %u early at %lld", delays[i], (long long) shots[i].at);
+    TEST_TRUE(shots[i].at <= delays[i] + LATE_MS, "once %u late at %lld", delays[i], (long long) shots[i].at);
+    TEST_TRUE(!timer_pending(&shots[i].timer), "once %u still pending", delays[i]);
+  }
+  // nothing pending, the wheel stops ticking
+  TEST_EQ(timer_next_ms(), -1, "idle");
+}
+
+/**
+ * stop and restart move a pending timer, a periodic timer repeats until
+ * it stops itself from its callback
+ */
+static void test_stop_restart(void)
+{
+  shot_t stopped, moved, periodic;
+
+  start_ms = now_ms();
+  shot(&stopped, 20, 0);
+  shot(&moved, 20, 0);
+  shot(&periodic, 10, 10);
+  periodic.stop_after = 5;
+
+  TEST_EQ(timer_stop(&stopped.timer), OK, "stop");
+  TEST_TRUE(!timer_pending(&stopped.timer), "stopped pending");
+  TEST_EQ(timer_start(&moved.timer, 80, 0), OK, "restart");
+  TEST_TRUE(timer_pending(&moved.timer), "restarted pending");
+
+  run_for(80 + LATE_MS * 2);
+
+  TEST_EQ(stopped.fired, 0, "stopped fired");
+  TEST_EQ(moved.fired, 1, "restarted fired");
+  TEST_TRUE(moved.at >= 80, "restarted early at %lld", (long long) moved.at);
+  TEST_EQ(periodic.fired, 5, "periodic runs");
+  TEST_TRUE(periodic.at >= 10, "periodic early at %lld", (long long) periodic.at);
+  TEST_TRUE(!timer_pending(&periodic.timer), "periodic pending");
+}
+
+/**
+ * many timers at once, each fires once and on time
+ */
+static void test_many(void)
+{
+  shot_t *shots = calloc(MANY, sizeof(shot_t));
+  int early = 0, late = 0, missed = 0;
+
+  if (NULL == shots) return;
+  srand(1);
+  start_ms = now_ms();
+  for (int i = 0; i < MANY; i++) shot(&shots[i], (uint32_t) (rand() % 200), 0);
+  run_for(200 + LATE_MS * 2);
+
+  for (int i = 0; i < MANY; i++) {
+    if (shots[i].fired != 1) missed++;
+    else if (shots[i].at < shots[i].ms) early++;
+    else if (shots[i].at > shots[i].ms + LATE_MS) late++;
+  }
+  TEST_EQ(missed, 0, "many missed");
+  TEST_EQ(early, 0, "many early");
+  TEST_EQ(late, 0, "many late");
+
+  free(shots);
+}
+
+int main()
+{
+  log_set_level(LOG_WARN);
+
+  TEST_EQ(timer_init(TICK_MS), OK, "init");
+  test_once();
+  test_stop_restart();
+  test_many();
+  timer_deinit();
+
+  return TEST_RESULT();
+}
@@ -0,0 +1,198 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <alloca.h>
+#include <unistd.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+#include "log.h"
+#include "error.h"
+#include "thread.h"
+
+
+LOG_TAG_DECLR("thread");
+
+static thread_config_t configs[THREAD_ROLE_MAX];
+
+struct thread_start_s {
+    thread_role_t role;
+    void *(*fn)(void *);
+    void *arg;
+};
+
+int thread_set_config(thread_role_t role, const thread_config_t *cfg)
+{
+  if (role >= THREAD_ROLE_MAX || NULL == cfg) return ERROR_ARG;
+  if (cfg->policy != 0 && cfg->policy != SCHED_FIFO && cfg->policy != SCHED_RR) return ERROR_ARG;
+  if (cfg->policy != 0 && (cfg->priority < sched_get_priority_min(cfg->policy)
+                           || cfg->priority > sched_get_priority_max(cfg->policy))) {
+    return ERROR_ARG;
+  }
+
+  configs[role] = *cfg;
+
+  return OK;
+}
+
+// stack kept free below a prefault for the frames the thread goes on to call
+#define PREFAULT_MARGIN   (64 * 1024)
+
+/**
+ * bytes of stack left below the caller, less PREFAULT_MARGIN
+ */
+static size_t prefault_limit(void)
+{
+  pthread_attr_t attr;
+  size_t size = 0;
+  char here;
+#ifdef __linux__
+  void *low = NULL;
+
+  if (0 != pthread_getattr_np(pthread_self(), &attr)) return 0;
+  if (0 == pthread_attr_getstack(&attr, &low, &size) && NULL != low) {
+    // the stack grows down from low + size, only what is under us is free
+    size = (size_t) (&here - (char *) low);
+  }
+#else
+  (void) here;
+  // the default stack of a new thread, the best guess without getattr_np
+  if (0 != pthread_attr_init(&attr)) return 0;
+  pthread_attr_getstacksize(&attr, &size);
+#endif
+  pthread_attr_destroy(&attr);
+
+  return size > PREFAULT_MARGIN ? size - PREFAULT_MARGIN : 0;
+}
+
+// a frame of prefault bytes, touched one page at a time, stays mapped once returned
+static void __attribute__((noinline)) prefault_stack(size_t size)
+{
+  volatile char *stack = alloca(size);
+  long page = sysconf(_SC_PAGESIZE);
+
+  for (size_t i = 0; i < size; i += page) {
+    stack[i] = 0;
+  }
+}
+
+int thread_apply(thread_role_t role)
+{
+  const thread_config_t *cfg;
+  struct sched_param param = {0};
+  int ret = OK, err;
+
+  if (role >= THREAD_ROLE_MAX) return ERROR_ARG;
+  cfg = &configs[role];
+
+#ifdef __linux__
+  if (cfg->cpus) {
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    for (int i = 0; i < 64 && i < CPU_SETSIZE; ++i) {
+      if (cfg->cpus & (1ULL << i)) CPU_SET(i, &set);
+    }
+    if (0 != (err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set))) {
+      LOGW("thread role %d affinity 0x%llx error: %s", role, (unsigned long long) cfg->cpus, strerror(err));
+      ret = ERROR_THREAD;
+    }
+  }
+#else
+  if (cfg->cpus) LOGW("thread affinity is not supported");
+#endif
+
+  if (cfg->policy) {
+    param.sched_priority = cfg->priority;
+    // EPERM without CAP_SYS_NICE or an RLIMIT_RTPRIO
+    if (0 != (err = pthread_setschedparam(pthread_self(), cfg->policy, &param))) {
+      LOGW("thread role %d policy %d priority %d error: %s", role, cfg->policy, cfg->priority, strerror(err));
+      ret = ERROR_THREAD;
+    }
+  }
+
+  if (cfg->prefault) {
+    size_t size = cfg->prefault, limit = prefault_limit();
+
+    // alloca() past the end of the stack would not fail, it would crash
+    if (size > limit) {
+      LOGW("thread role %d prefault %zu exceeds the stack, %zu instead", role, size, limit);
+      size = limit;
+    }
+    if (size) prefault_stack(size);
+  }
+
+  return ret;
+}
+
+static void *thread_start(void *arg)
+{
+  struct thread_start_s start = *(struct thread_start_s *) arg;
+
+  free(arg);
+  thread_apply(start.role);
+
+  return start.fn(start.arg);
+}
+
+int thread_create(pthread_t *thread, thread_role_t role, const char *name, void *(*fn)(void *), void *arg)
+{
+  struct thread_start_s *start;
+  int err;
+
+  if (role >= THREAD_ROLE_MAX || NULL == fn) return ERROR_ARG;
+
+  start = malloc(sizeof(*start));
+  if (NULL == start) return ERROR_THREAD;
+  start->role = role;
+  start->fn = fn;
+  start->arg = arg;
+
+  if (0 != (err = pthread_create(thread, NULL, thread_start, start))) {
+    LOGE("pthread create error: %s", strerror(err));
+    free(start);
+    return ERROR_THREAD;
+  }
+
+#ifdef __linux__
+  if (name) pthread_setname_np(*thread, name);
+#endif
+
+  return OK;
+}
+
+int thread_lock_memory()
+{
+#ifndef WIN32
+  if (0 > mlockall(MCL_CURRENT | MCL_FUTURE)) {
+    LOGW("mlockall error: %m");
+    return ERROR_THREAD;
+  }
+  return OK;
+#else
+  return ERROR_THREAD;
+#endif
+}
@@ -0,0 +1,75 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef THREAD_H
+#define THREAD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+typedef enum thread_role_e {
+    // the application thread calling event_start(), applied on its first call
+    THREAD_ROLE_EVENT,
+    // udp/uring reader and the shard readers
+    THREAD_ROLE_PROTOCOL,
+    // read_cb callback threads, the pipeline runs here
+    THREAD_ROLE_RECEIVE,
+    // audio processing threads of the application
+    THREAD_ROLE_DSP,
+    THREAD_ROLE_MAX,
+} thread_role_t;
+
+typedef struct thread_config_s {
+    // bit n runs the thread on CPU n, 0 leaves the affinity alone
+    uint64_t cpus;
+    // SCHED_FIFO or SCHED_RR with priority 1-99, 0 (SCHED_OTHER) leaves it alone
+    int policy;
+    int priority;
+    // bytes of stack to touch before the thread starts working, 0 is none,
+    // cut down to what the stack holds less 64KiB
+    size_t prefault;
+} thread_config_t;
+
+/**
+ * Set what threads of role get, the zero config (default) changes nothing.
+ * Call it before the threads are created, event_init() and the like.
+ */
+int thread_set_config(thread_role_t role, const thread_config_t *cfg);
+
+/**
+ * apply the config of role to the calling thread, for threads the
+ * library does not create, e.g. THREAD_ROLE_DSP
+ *
+ * @return OK, or ERROR_THREAD if part of it was refused (e.g. EPERM)
+ */
+int thread_apply(thread_role_t role);
+
+/**
+ * pthread_create() that applies the config of role in the new thread first
+ *
+ * @param name  thread name, 15 chars at most
+ */
+int thread_create(pthread_t *thread, thread_role_t role, const char *name, void *(*fn)(void *), void *arg);
+
+/**
+ * mlockall() current and future pages, so the hot path never page faults
+ */
+int thread_lock_memory();
+
+#endif //THREAD_H
@@ -0,0 +1,299 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/timerfd.h>
+#endif
+#include "log.h"
+#include "error.h"
+#include "timer.h"
+
+
+#define TIMER_WHEEL_MASK    (TIMER_WHEEL_SIZE - 1)
+#define TIMER_WHEEL_SPAN    (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+// slot of expires at level
+#define TIMER_SLOT(expires, level) (((expires) >> (TIMER_WHEEL_BITS * (level))) & TIMER_WHEEL_MASK)
+
+LOG_TAG_DECLR("timer");
+
+/*
+ * Level 0 holds the next 64 ticks one per slot, level n the next 64^(n+1)
+ * with 64^n ticks per slot. Whenever level n wraps, the current slot of
+ * level n + 1 is spread down. Nothing is ever scanned but the timers due.
+ */
+static struct {
+    pthread_mutex_t lock;
+    int inited;
+    int fd;
+    int armed;
+    uint32_t tick_ms;
+    struct timespec start;
+    // next tick to run
+    uint64_t tick;
+    uint32_t pending;
+    wheel_timer_t *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+} wheel = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .fd = -1,
+};
+
+static uint64_t now_tick()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  // whole ns first: a negative tv_nsec difference divided alone rounds up
+  return (uint64_t) (((int64_t) (now.tv_sec - wheel.start.tv_sec) * 1000000000
+                      + (now.tv_nsec - wheel.start.tv_nsec)) / 1000000) / wheel.tick_ms;
+}
+
+static void arm(int on)
+{
+#ifdef __linux__
+  struct itimerspec its = {0};
+
+  if (on) {
+    its.it_interval.tv_sec = wheel.tick_ms / 1000;
+    its.it_interval.tv_nsec = (long) (wheel.tick_ms % 1000) * 1000000;
+    its.it_value = its.it_interval;
+  }
+  if (wheel.fd >= 0 && timerfd_settime(wheel.fd, 0, &its, NULL) < 0) {
+    LOGE("timerfd settime error: %m");
+  }
+#endif
+  wheel.armed = on;
+}
+
+static void link_timer(wheel_timer_t *t)
+{
+  uint64_t delta;
+  wheel_timer_t **slot;
+  int level = 0;
+
+  if (t->expires < wheel.tick) t->expires = wheel.tick;
+  delta = t->expires - wheel.tick;
+  if (delta >= TIMER_WHEEL_SPAN) {
+    t->expires = wheel.tick + TIMER_WHEEL_SPAN - 1;
+    delta = TIMER_WHEEL_SPAN - 1;
+  }
+  while (delta >= (1ULL << (TIMER_WHEEL_BITS * (level + 1)))) {
+    level++;
+  }
+
+  slot = &wheel.slots[level][TIMER_SLOT(t->expires, level)];
+  t->next = *slot;
+  if (*slot) (*slot)->pprev = &t->next;
+  t->pprev = slot;
+  *slot = t;
+}
+
+static void unlink_timer(wheel_timer_t *t)
+{
+  *t->pprev = t->next;
+  if (t->next) t->next->pprev = t->pprev;
+  t->next = NULL;
+  t->pprev = NULL;
+}
+
+/**
+ * spread a slot of level down, return its index
+ */
+static int cascade(int level, int index)
+{
+  wheel_timer_t *t = wheel.slots[level][index], *next;
+
+  wheel.slots[level][index] = NULL;
+  for (; t; t = next) {
+    next = t->next;
+    link_timer(t);
+  }
+
+  return index;
+}
+
+int timer_init(uint32_t tick_ms)
+{
+  if (0 == tick_ms) return ERROR_ARG;
+
+  pthread_mutex_lock(&wheel.lock);
+  if (wheel.inited) {
+    pthread_mutex_unlock(&wheel.lock);
+    return OK;
+  }
+
+#ifdef __linux__
+  wheel.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (wheel.fd < 0) {
+    LOGE("timerfd create error: %m");
+    pthread_mutex_unlock(&wheel.lock);
+    return ERROR_ARG;
+  }
+#endif
+  wheel.tick_ms = tick_ms;
+  clock_gettime(CLOCK_MONOTONIC, &wheel.start);
+  wheel.tick = 0;
+  wheel.pending = 0;
+  wheel.armed = 0;
+  memset(wheel.slots, 0, sizeof(wheel.slots));
+  wheel.inited = 1;
+  pthread_mutex_unlock(&wheel.lock);
+
+  return OK;
+}
+
+int timer_deinit()
+{
+  wheel_timer_t *t;
+
+  pthread_mutex_lock(&wheel.lock);
+  // the owners still hold them, leave them not pending
+  for (int l = 0; l < TIMER_WHEEL_LEVELS; ++l) {
+    for (int i = 0; i < TIMER_WHEEL_SIZE; ++i) {
+      while ((t = wheel.slots[l][i])) unlink_timer(t);
+    }
+  }
+  wheel.pending = 0;
+  if (wheel.fd >= 0) close(wheel.fd);
+  wheel.fd = -1;
+  wheel.inited = 0;
+  pthread_mutex_unlock(&wheel.lock);
+
+  return OK;
+}
+
+int timer_fd()
+{
+  return wheel.fd;
+}
+
+int timer_next_ms()
+{
+  return wheel.armed ? (int) wheel.tick_ms : -1;
+}
+
+int timer_process()
+{
+  wheel_timer_t *t;
+  uint64_t target, expirations;
+  int index;
+
+#ifdef __linux__
+  // only a wakeup, the clock says how far to go
+  if (wheel.fd >= 0) while (read(wheel.fd, &expirations, sizeof(expirations)) > 0);
+#endif
+
+  pthread_mutex_lock(&wheel.lock);
+  if (!wheel.inited) {
+    pthread_mutex_unlock(&wheel.lock);
+    return ERROR_ARG;
+  }
+
+  target = now_tick();
+  while (wheel.pending && wheel.tick <= target) {
+    index = (int) (wheel.tick & TIMER_WHEEL_MASK);
+    if (0 == index) {
+      for (int l = 1; l < TIMER_WHEEL_LEVELS && 0 == cascade(l, (int) TIMER_SLOT(wheel.tick, l)); ++l);
+    }
+    // started from a callback with no delay, it runs on the next tick
+    wheel.tick++;
+
+    while ((t = wheel.slots[0][index])) {
+      unlink_timer(t);
+      if (t->period) {
+        t->expires += t->period;
+        link_timer(t);
+      } else {
+        wheel.pending--;
+      }
+
+      pthread_mutex_unlock(&wheel.lock);
+      t->cb(t, t->arg);
+      pthread_mutex_lock(&wheel.lock);
+    }
+  }
+  // nothing left, catch up and stop ticking
+  if (0 == wheel.pending) {
+    wheel.tick = target + 1;
+    if (wheel.armed) arm(0);
+  }
+  pthread_mutex_unlock(&wheel.lock);
+
+  return OK;
+}
+
+void timer_setup(wheel_timer_t *t, timer_fn cb, void *arg)
+{
+  memset(t, 0, sizeof(*t));
+  t->cb = cb;
+  t->arg = arg;
+}
+
+int timer_start(wheel_timer_t *t, uint32_t ms, uint32_t period_ms)
+{
+  uint64_t now;
+
+  if (NULL == t || NULL == t->cb) return ERROR_ARG;
+
+  pthread_mutex_lock(&wheel.lock);
+  if (!wheel.inited) {
+    pthread_mutex_unlock(&wheel.lock);
+    return ERROR_ARG;
+  }
+
+  now = now_tick();
+  if (t->pprev) {
+    unlink_timer(t);
+  } else {
+    // the wheel stood still while empty
+    if (0 == wheel.pending++) wheel.tick = now + 1;
+  }
+
+  // the current tick is partly gone, round up past it so it never fires early
+  t->expires = now + 1 + (ms + wheel.tick_ms - 1) / wheel.tick_ms;
+  t->period = period_ms ? (period_ms + wheel.tick_ms - 1) / wheel.tick_ms : 0;
+  link_timer(t);
+
+  if (!wheel.armed) arm(1);
+  pthread_mutex_unlock(&wheel.lock);
+
+  return OK;
+}
+
+int timer_stop(wheel_timer_t *t)
+{
+  if (NULL == t) return ERROR_ARG;
+
+  pthread_mutex_lock(&wheel.lock);
+  if (t->pprev) {
+    unlink_timer(t);
+    wheel.pending--;
+  }
+  pthread_mutex_unlock(&wheel.lock);
+
+  return OK;
+}
+
+int timer_pending(const wheel_timer_t *t)
+{
+  return NULL != t && NULL != __atomic_load_n(&t->pprev, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,90 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+// default resolution, timers fire on the first tick at or after their time
+#define TIMER_TICK_MS       10
+
+#define TIMER_WHEEL_BITS    6
+#define TIMER_WHEEL_SIZE    (1 << TIMER_WHEEL_BITS)
+// 64 ^ 4 ticks, about 46.6 hours at 10ms, longer timeouts are clamped
+#define TIMER_WHEEL_LEVELS  4
+
+typedef struct wheel_timer_s wheel_timer_t;
+
+typedef void (*timer_fn)(wheel_timer_t *t, void *arg);
+
+/**
+ * Embedded in whatever it times, e.g. speaker_t. Starting, stopping and
+ * expiring are O(1) whatever the number of timers.
+ */
+struct wheel_timer_s {
+    wheel_timer_t *next;
+    // NULL while not pending
+    wheel_timer_t **pprev;
+    // tick it is due
+    uint64_t expires;
+    // ticks between two runs, 0 runs once
+    uint32_t period;
+    timer_fn cb;
+    void *arg;
+};
+
+/**
+ * Called by event_init(), the event backend polls timer_fd() and callbacks
+ * run on the thread calling event_start().
+ */
+int timer_init(uint32_t tick_ms);
+
+int timer_deinit();
+
+/**
+ * a timerfd ticking while any timer is pending, -1 without timerfd
+ */
+int timer_fd();
+
+/**
+ * ms until the next tick while a timer is pending, -1 otherwise
+ */
+int timer_next_ms();
+
+/**
+ * run every timer that is due, timer_fd() polled readable or not
+ */
+int timer_process();
+
+void timer_setup(wheel_timer_t *t, timer_fn cb, void *arg);
+
+/**
+ * (re)start t to fire in ms, then every period_ms if not 0. Safe from any
+ * thread.
+ */
+int timer_start(wheel_timer_t *t, uint32_t ms, uint32_t period_ms);
+
+/**
+ * From another thread, the callback may still be running when it returns.
+ */
+int timer_stop(wheel_timer_t *t);
+
+int timer_pending(const wheel_timer_t *t);
+
+#endif //TIMER_H
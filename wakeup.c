@@ -0,0 +1,185 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <errno.h>
+#if WIN32
+#include <winsock2.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+#include "log.h"
+#include "error.h"
+#include "wakeup.h"
+
+
+LOG_TAG_DECLR("wakeup");
+
+#ifdef __linux__
+
+int wakeup_init(wakeup_t *w)
+{
+  w->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (w->fd < 0) {
+    LOGE("eventfd error: %m");
+    return ERROR_ARG;
+  }
+
+  return OK;
+}
+
+void wakeup_deinit(wakeup_t *w)
+{
+  if (w->fd >= 0) close(w->fd);
+  w->fd = -1;
+}
+
+int wakeup_signal(wakeup_t *w)
+{
+  uint64_t one = 1;
+
+  if (w->fd < 0) return ERROR_ARG;
+  // EAGAIN only when the counter is about to overflow, still readable
+  if (write(w->fd, &one, sizeof(one)) < 0 && errno != EAGAIN) return ERROR_ARG;
+
+  return OK;
+}
+
+uint64_t wakeup_drain(wakeup_t *w)
+{
+  uint64_t n = 0;
+
+  if (w->fd < 0 || read(w->fd, &n, sizeof(n)) != sizeof(n)) return 0;
+
+  return n;
+}
+
+#elif WIN32
+
+int wakeup_init(wakeup_t *w)
+{
+  struct sockaddr_in addr;
+  int len = sizeof(addr);
+  u_long on = 1;
+  SOCKET s;
+
+  s = socket(AF_INET, SOCK_DGRAM, 0);
+  if (INVALID_SOCKET == s) {
+    LOGE("wakeup socket error: %d", WSAGetLastError());
+    return ERROR_ARG;
+  }
+
+  // datagrams sent to itself make it readable, like the write end of a pipe
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (0 != bind(s, (struct sockaddr *) &addr, sizeof(addr))
+      || 0 != getsockname(s, (struct sockaddr *) &addr, &len)
+      || 0 != connect(s, (struct sockaddr *) &addr, len)
+      || 0 != ioctlsocket(s, FIONBIO, &on)) {
+    LOGE("wakeup socket setup error: %d", WSAGetLastError());
+    closesocket(s);
+    return ERROR_ARG;
+  }
+  w->fd = (int64_t) s;
+
+  return OK;
+}
+
+void wakeup_deinit(wakeup_t *w)
+{
+  if (w->fd >= 0) closesocket((SOCKET) w->fd);
+  w->fd = -1;
+}
+
+int wakeup_signal(wakeup_t *w)
+{
+  static const char one = 1;
+
+  if (w->fd < 0) return ERROR_ARG;
+  // a full buffer is readable already
+  if (SOCKET_ERROR == send((SOCKET) w->fd, &one, 1, 0) && WSAEWOULDBLOCK != WSAGetLastError()) return ERROR_ARG;
+
+  return OK;
+}
+
+uint64_t wakeup_drain(wakeup_t *w)
+{
+  char buf[16];
+  uint64_t n = 0;
+
+  if (w->fd < 0) return 0;
+  // one datagram per signal
+  while (recv((SOCKET) w->fd, buf, sizeof(buf), 0) > 0) n++;
+
+  return n;
+}
+
+#else
+
+int wakeup_init(wakeup_t *w)
+{
+  int fds[2];
+
+  if (pipe(fds) < 0) {
+    LOGE("pipe error: %m");
+    return ERROR_ARG;
+  }
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  fcntl(fds[1], F_SETFL, O_NONBLOCK);
+  w->fd = fds[0];
+  w->wfd = fds[1];
+
+  return OK;
+}
+
+void wakeup_deinit(wakeup_t *w)
+{
+  if (w->fd >= 0) close(w->fd);
+  if (w->wfd >= 0) close(w->wfd);
+  w->fd = w->wfd = -1;
+}
+
+int wakeup_signal(wakeup_t *w)
+{
+  static const char one = 1;
+
+  if (w->wfd < 0) return ERROR_ARG;
+  // a full pipe is readable already
+  if (write(w->wfd, &one, 1) < 0 && errno != EAGAIN) return ERROR_ARG;
+
+  return OK;
+}
+
+uint64_t wakeup_drain(wakeup_t *w)
+{
+  char buf[64];
+  uint64_t n = 0;
+  ssize_t r;
+
+  if (w->fd < 0) return 0;
+  while ((r = read(w->fd, buf, sizeof(buf))) > 0) n += (uint64_t) r;
+
+  return n;
+}
+
+#endif
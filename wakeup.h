@@ -0,0 +1,78 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef WAKEUP_H
+#define WAKEUP_H
+
+#include <stdint.h>
+
+/**
+ * A readable fd another thread can poke. It carries no payload: a thread
+ * polls wakeup_fd() along with its sockets, drains it, then looks at its
+ * own state (a stop flag, a queue) to learn why it was woken. Signals
+ * coalesce, several wakeup_signal() before a drain wake once.
+ *
+ * eventfd on linux, a loopback UDP socket connected to itself on WIN32
+ * (select() there takes sockets only), a nonblocking pipe elsewhere.
+ */
+typedef struct wakeup_s
+{
+#if WIN32
+    // a SOCKET, as socket_t
+    int64_t fd;
+#else
+    int fd;
+#endif
+#if !defined(__linux__) && !WIN32
+    // write end of the pipe
+    int wfd;
+#endif
+} wakeup_t;
+
+#if defined(__linux__) || WIN32
+#define WAKEUP_INITIALIZER  {.fd = -1}
+#else
+#define WAKEUP_INITIALIZER  {.fd = -1, .wfd = -1}
+#endif
+
+int wakeup_init(wakeup_t *w);
+
+void wakeup_deinit(wakeup_t *w);
+
+/**
+ * wake whoever polls w, safe from any thread
+ */
+int wakeup_signal(wakeup_t *w);
+
+/**
+ * consume pending signals so the fd stops polling readable
+ *
+ * @return number of signals since the last drain, 0 if none
+ */
+uint64_t wakeup_drain(wakeup_t *w);
+
+#if WIN32
+static inline int64_t wakeup_fd(const wakeup_t *w)
+#else
+static inline int wakeup_fd(const wakeup_t *w)
+#endif
+{
+  return w->fd;
+}
+
+#endif //WAKEUP_H